@@ -0,0 +1,78 @@
+/*
+ * accel.h - Fixed-point pointer transform for naga-remap
+ *
+ * Sensitivity and the acceleration curve are folded into one lookup table
+ * of Q16.16 gains indexed by the speed of the report (counts per report,
+ * approximated as max + min/2 of |dx|, |dy|). Applying it is two absolute
+ * values, a clamped table load and two multiplies. The fractional part of
+ * every scaled delta is carried to the next report, so slow motion at low
+ * gain still adds up instead of being rounded away.
+ */
+#ifndef ACCEL_H
+#define ACCEL_H
+
+#include <stdint.h>
+
+#define ACCEL_LUT       128     /* speeds >= ACCEL_LUT-1 use the last entry */
+#define ACCEL_SHIFT     16
+#define ACCEL_ONE       (1 << ACCEL_SHIFT)
+#define ACCEL_MAX_GAIN  64.0
+
+typedef struct {
+    int64_t rx, ry;             /* Q16 remainders, in [-1/2, 1/2) */
+} accel_state_t;
+
+/*
+ * Fill lut with scale * curve(speed), where the curve interpolates
+ * linearly between n (speed, factor) points sorted by speed and is flat
+ * beyond both ends. No points means a flat curve of 1.
+ */
+static void accel_build(int32_t *lut, const double (*pts)[2], int n, double scale) {
+    for (int s = 0; s < ACCEL_LUT; s++) {
+        double f = 1.0;
+        if (n > 0) {
+            f = pts[n - 1][1];
+            if (s <= pts[0][0]) {
+                f = pts[0][1];
+            } else {
+                for (int i = 1; i < n; i++) {
+                    if (s <= pts[i][0]) {
+                        double span = pts[i][0] - pts[i - 1][0];
+                        double t = span > 0 ? (s - pts[i - 1][0]) / span : 1.0;
+                        f = pts[i - 1][1] + t * (pts[i][1] - pts[i - 1][1]);
+                        break;
+                    }
+                }
+            }
+        }
+        double g = f * scale;
+        if (g < 0) g = 0;
+        if (g > ACCEL_MAX_GAIN) g = ACCEL_MAX_GAIN;
+        lut[s] = (int32_t)(g * ACCEL_ONE + 0.5);
+    }
+}
+
+static inline uint32_t accel_abs(int32_t v) {
+    int32_t m = v >> 31;
+    return (uint32_t)((v ^ m) - m);
+}
+
+/* Scale one report in place, rounding to nearest and keeping the rest */
+static inline void accel_apply(const int32_t *lut, accel_state_t *st,
+                               int32_t *dx, int32_t *dy) {
+    uint32_t ax = accel_abs(*dx), ay = accel_abs(*dy);
+    uint32_t hi = ax > ay ? ax : ay;
+    uint32_t speed = hi + ((ax ^ ay ^ hi) >> 1);
+    int64_t gain = lut[speed < ACCEL_LUT - 1 ? speed : ACCEL_LUT - 1];
+
+    int64_t x = st->rx + (int64_t)*dx * gain;
+    int64_t y = st->ry + (int64_t)*dy * gain;
+    int64_t ox = (x + ACCEL_ONE / 2) >> ACCEL_SHIFT;
+    int64_t oy = (y + ACCEL_ONE / 2) >> ACCEL_SHIFT;
+    st->rx = x - ox * ACCEL_ONE;
+    st->ry = y - oy * ACCEL_ONE;
+    *dx = (int32_t)ox;
+    *dy = (int32_t)oy;
+}
+
+#endif /* ACCEL_H */
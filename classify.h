@@ -0,0 +1,108 @@
+/*
+ * classify.h - Batch event classifier for naga-remap
+ *
+ * Sorts up to 64 input events into one bitmask per kind, bit i standing
+ * for event i, so the pointer path can find frame ends with a count of
+ * trailing zeros and tell a frame of plain motion from one that needs the
+ * per-event path with a single AND. Button events a caller has to act
+ * on are picked out of the EV_KEY mask with class_select_keys(). With
+ * SSE2 the type and code of four events (one 32-bit word each, at the
+ * same offset in every record) are gathered into one register and
+ * compared against every kind at once; elsewhere, or built with
+ * -DCLASSIFY_SCALAR, the same masks are built one event at a time.
+ */
+#ifndef CLASSIFY_H
+#define CLASSIFY_H
+
+#include <stdint.h>
+#include <string.h>
+#include <linux/input.h>
+
+#if defined(__SSE2__) && defined(__x86_64__) && defined(__LP64__) && !defined(CLASSIFY_SCALAR)
+#include <emmintrin.h>
+#define CLASSIFY_SIMD 1
+#else
+#define CLASSIFY_SIMD 0
+#endif
+
+#define CLASSIFY_MAX    64
+
+/* type | code << 16, as the record holds them on a little-endian machine */
+#define CLASS_TC(type, code)    ((uint32_t)(type) | (uint32_t)(code) << 16)
+
+typedef struct {
+    uint64_t syn;               /* SYN_REPORT */
+    uint64_t rel_x, rel_y;
+    uint64_t msc;               /* EV_MSC, any code */
+    uint64_t key;               /* EV_KEY, any code */
+} ev_class_t;
+
+static inline uint32_t class_tc(const struct input_event *ev) {
+    uint32_t tc;
+    memcpy(&tc, &ev->type, sizeof(tc));
+    return tc;
+}
+
+static inline void classify_one(const struct input_event *ev, int i, ev_class_t *cl) {
+    uint32_t tc = class_tc(ev);
+    uint64_t bit = 1ULL << i;
+    if (tc == CLASS_TC(EV_SYN, SYN_REPORT))
+        cl->syn |= bit;
+    else if (tc == CLASS_TC(EV_REL, REL_X))
+        cl->rel_x |= bit;
+    else if (tc == CLASS_TC(EV_REL, REL_Y))
+        cl->rel_y |= bit;
+    else if ((tc & 0xffff) == EV_MSC)
+        cl->msc |= bit;
+    else if ((tc & 0xffff) == EV_KEY)
+        cl->key |= bit;
+}
+
+/* Classify n <= CLASSIFY_MAX events */
+static inline void classify_batch(const struct input_event *buf, int n, ev_class_t *cl) {
+    int i = 0;
+    memset(cl, 0, sizeof(*cl));
+#if CLASSIFY_SIMD
+    const __m128i syn = _mm_set1_epi32((int)CLASS_TC(EV_SYN, SYN_REPORT));
+    const __m128i rel_x = _mm_set1_epi32((int)CLASS_TC(EV_REL, REL_X));
+    const __m128i rel_y = _mm_set1_epi32((int)CLASS_TC(EV_REL, REL_Y));
+    const __m128i msc = _mm_set1_epi32(EV_MSC);
+    const __m128i key = _mm_set1_epi32(EV_KEY);
+    const __m128i type = _mm_set1_epi32(0xffff);
+    for (; i + 4 <= n; i += 4) {
+        /* type, code and value of each record are its last 8 bytes */
+        __m128i a = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)&buf[i].type),
+                                       _mm_loadl_epi64((const __m128i *)&buf[i + 1].type));
+        __m128i b = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)&buf[i + 2].type),
+                                       _mm_loadl_epi64((const __m128i *)&buf[i + 3].type));
+        __m128i tc = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b),
+                                                     _MM_SHUFFLE(2, 0, 2, 0)));
+        cl->syn |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(tc, syn))) << i;
+        cl->rel_x |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(tc, rel_x))) << i;
+        cl->rel_y |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(tc, rel_y))) << i;
+        __m128i t = _mm_and_si128(tc, type);
+        cl->msc |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(t, msc))) << i;
+        cl->key |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(t, key))) << i;
+    }
+#endif
+    for (; i < n; i++)
+        classify_one(&buf[i], i, cl);
+}
+
+/*
+ * The EV_KEY events of keys whose code is set in bits (KEY_CNT bits).
+ * Codes past KEY_CNT are always picked, as no table covers them.
+ */
+static inline uint64_t class_select_keys(const struct input_event *buf, uint64_t keys,
+                                         const unsigned char *bits) {
+    uint64_t picked = 0;
+    for (; keys; keys &= keys - 1) {
+        int i = __builtin_ctzll(keys);
+        unsigned code = buf[i].code;
+        if (code >= KEY_CNT || ((bits[code / 8] >> (code % 8)) & 1))
+            picked |= 1ULL << i;
+    }
+    return picked;
+}
+
+#endif /* CLASSIFY_H */
@@ -7,24 +7,138 @@
 #include <linux/input-event-codes.h>
 #include <string.h>
 
+#include "accel.h"
+#include "expand.h"
+
 #define MAX_KEYS        8
 #define MAX_MAPPINGS    24
 #define MAX_CMD_LEN     512
 #define MAX_DESC_LEN    64
+#define MAX_ACCEL_POINTS 16
+#define MAX_PROFILES    8
+#define MAX_MATCH_LEN   64
+#define MAX_SOCD_GROUPS 8
+#define MAX_SOCD_KEYS   4
+#define MAX_GESTURES    16
+#define MAX_STROKE      4
+
+/* Modifiers a mapping can require, left and right alike */
+#define MOD_CTRL        1
+#define MOD_SHIFT       2
+#define MOD_ALT         4
+#define MOD_META        8
+#define MOD_MASKS       16
 
 typedef struct {
     int button;                     /* source keycode (e.g. KEY_KP1) */
+    int modifiers;                  /* MOD_* held on a keyboard, 0 = whatever is held */
     char description[MAX_DESC_LEN];
     /* key combo mode */
     int keys[MAX_KEYS];             /* keycodes to emit */
     int num_keys;
     /* command mode */
     char command[MAX_CMD_LEN];      /* shell command (empty = key mode) */
+    int kernel;                     /* 1:1 mapping offloaded to the device keymap */
+    int socd, socd_slot;            /* opposing group + 1 (0 = none), place in it */
 } key_mapping_t;
 
+/* Stroke directions, clockwise from right; screen y grows downwards */
+enum {
+    DIR_RIGHT, DIR_DOWN_RIGHT, DIR_DOWN, DIR_DOWN_LEFT,
+    DIR_LEFT, DIR_UP_LEFT, DIR_UP, DIR_UP_RIGHT, DIR_COUNT
+};
+
+/* A stroke drawn while the gesture button is held, and what it fires */
+typedef struct {
+    unsigned char dirs[MAX_STROKE]; /* DIR_* per segment */
+    int num_dirs;                   /* 0 = button tapped without moving */
+    key_mapping_t action;           /* keys or command; button unused */
+} gesture_t;
+
 typedef struct {
+    int button;                     /* held: record a stroke (0 = off) */
+    int step;                       /* counts of motion per direction sample */
+    int min_distance;               /* counts one way before it is a segment */
+    gesture_t gestures[MAX_GESTURES];
+    int num_gestures;
+} gesture_cfg_t;
+
+/* Wheel stage of the pointer interface */
+typedef struct {
+    double speed;                   /* multiplier on wheel motion */
+    int invert;                     /* reverse the direction */
+    double accel[MAX_ACCEL_POINTS][2];  /* (notches per second, factor) */
+    int num_accel;
+    int32_t lut[ACCEL_LUT];         /* Q16 gain by notch rate, built at load */
+    /* kinetic: keep scrolling after a flick, slowing down every tick */
+    int kinetic;
+    double kinetic_decay;           /* velocity kept per tick */
+    int kinetic_interval_ms;
+    double kinetic_min_speed;       /* notches/s needed to start gliding */
+} scroll_cfg_t;
+
+/* Main pointer interface passthrough */
+typedef struct {
+    int enabled;                    /* grab the pointer node and forward it */
+    double sensitivity;             /* multiplier on every motion report */
+    double accel[MAX_ACCEL_POINTS][2];  /* (counts per report, factor) */
+    int num_accel;
+    int sniper_button;              /* held: sniper gain (0 = none) */
+    double sniper_sensitivity;      /* relative to sensitivity */
+    /* Q16 gain by speed, [0] normal, [1] sniper; built by compile_pointer() */
+    int32_t lut[2][ACCEL_LUT];
+    scroll_cfg_t scroll;
+    gesture_cfg_t gesture;
+} pointer_cfg_t;
+
+/* Chatter filter for worn switches */
+typedef struct {
+    int deferred;                   /* hold releases for the window (default: eager) */
+    uint16_t ms[KEY_CNT];           /* window per button, 0 = off */
+} debounce_cfg_t;
+
+/* Opposing mappings: while several are held, only the latest is down */
+typedef struct {
+    int buttons[MAX_SOCD_KEYS];
+    int num_buttons;
+} socd_group_t;
+
+/* Which input node a profile applies to; -1 / empty fields match anything */
+typedef struct {
+    int vendor, product;
+    char name[MAX_MATCH_LEN];       /* substring of the device name */
+    char phys[MAX_MATCH_LEN];       /* suffix of the phys path, e.g. "/input2" */
+} device_match_t;
+
+/* One mouse model: how to find its interfaces and what to do with them */
+typedef struct {
+    char label[MAX_DESC_LEN];
+    device_match_t match;           /* side-button (keyboard) interface */
+    int keyboard;                   /* match is a whole keyboard, passthrough by default */
+    device_match_t pointer_match;   /* main pointer interface */
     key_mapping_t mappings[MAX_MAPPINGS];
     int num_mappings;
+    pointer_cfg_t pointer;
+    debounce_cfg_t debounce;
+    socd_group_t socd[MAX_SOCD_GROUPS];
+    int num_socd;
+    /* button -> mapping index + 1 (0 = unmapped), built by compile_mappings() */
+    unsigned char lookup[KEY_CNT];
+    /* (held modifiers, button) -> most specific mapping that applies + 1 */
+    unsigned char mod_lookup[MOD_MASKS][KEY_CNT];
+    /* Unmapped buttons to forward as-is ("passthrough"; all on a keyboard) */
+    unsigned char passthrough[KEY_CNT / 8 + 1];
+    /* Of those, the ones forwarded as they come, without a lookup */
+    unsigned char forward[KEY_CNT / 8 + 1];
+    /* Pointer buttons that need the mapping engine or debounce */
+    unsigned char engine[KEY_CNT / 8 + 1];
+} profile_t;
+
+/* "devices" entries, or one profile built from top-level "mappings" */
+typedef struct {
+    profile_t profiles[MAX_PROFILES];
+    int num_profiles;
+    expand_t expand;                /* "expansions", compiled; heap, see expand_free() */
 } config_t;
 
 /* Key name -> keycode lookup table */
@@ -131,6 +245,16 @@ static const key_entry_t key_table[] = {
     {"KEY_BACK",         KEY_BACK},
     {"KEY_FORWARD",      KEY_FORWARD},
 
+    /* Mouse buttons (main pointer interface) */
+    {"BTN_LEFT",         BTN_LEFT},
+    {"BTN_RIGHT",        BTN_RIGHT},
+    {"BTN_MIDDLE",       BTN_MIDDLE},
+    {"BTN_SIDE",         BTN_SIDE},
+    {"BTN_EXTRA",        BTN_EXTRA},
+    {"BTN_FORWARD",      BTN_FORWARD},
+    {"BTN_BACK",         BTN_BACK},
+    {"BTN_TASK",         BTN_TASK},
+
     /* Misc */
     {"KEY_PRINT",        KEY_PRINT},
     {"KEY_SCROLLLOCK",   KEY_SCROLLLOCK},
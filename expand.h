@@ -0,0 +1,229 @@
+/*
+ * expand.h - Abbreviation trie for naga-remap text expansion
+ *
+ * The abbreviations are compiled once into a dense trie: one row of
+ * transitions per node, one column per character that occurs in any
+ * abbreviation, all in a single array. Node 0 is a dead end whose row is
+ * all zeros, so a typed character costs one table load whether or not it
+ * can still lead to a match, and the dictionary size never shows up in
+ * the per-key work. The expansions live back to back in one text pool.
+ *
+ * Characters are mapped to keys on a US layout, in both directions.
+ */
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include <ctype.h>
+#include <linux/input-event-codes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EXPAND_MAX_ABBREV   32      /* characters in an abbreviation */
+#define EXPAND_ROOT         1
+
+typedef struct {
+    uint32_t *next;             /* nodes * nsym child indices, 0 = none */
+    uint32_t *hit;              /* per node: expansion index + 1, 0 = none */
+    uint32_t *text;             /* per expansion: offset in pool */
+    uint8_t *len;               /* per expansion: characters to take back */
+    char *pool;
+    unsigned char sym[128];     /* ASCII -> column + 1, 0: in no abbreviation */
+    int nsym, nodes, count;
+} expand_t;
+
+/* Typed characters since the last word boundary, as trie nodes */
+typedef struct {
+    uint32_t stack[EXPAND_MAX_ABBREV + 1];
+    int depth;
+} expand_state_t;
+
+/* Character of each key on a US layout, without and with shift */
+static const char expand_us[2][KEY_SPACE + 1] = {
+    {
+        [KEY_1] = '1', [KEY_2] = '2', [KEY_3] = '3', [KEY_4] = '4', [KEY_5] = '5',
+        [KEY_6] = '6', [KEY_7] = '7', [KEY_8] = '8', [KEY_9] = '9', [KEY_0] = '0',
+        [KEY_MINUS] = '-', [KEY_EQUAL] = '=', [KEY_TAB] = '\t',
+        [KEY_Q] = 'q', [KEY_W] = 'w', [KEY_E] = 'e', [KEY_R] = 'r', [KEY_T] = 't',
+        [KEY_Y] = 'y', [KEY_U] = 'u', [KEY_I] = 'i', [KEY_O] = 'o', [KEY_P] = 'p',
+        [KEY_LEFTBRACE] = '[', [KEY_RIGHTBRACE] = ']', [KEY_ENTER] = '\n',
+        [KEY_A] = 'a', [KEY_S] = 's', [KEY_D] = 'd', [KEY_F] = 'f', [KEY_G] = 'g',
+        [KEY_H] = 'h', [KEY_J] = 'j', [KEY_K] = 'k', [KEY_L] = 'l',
+        [KEY_SEMICOLON] = ';', [KEY_APOSTROPHE] = '\'', [KEY_GRAVE] = '`',
+        [KEY_BACKSLASH] = '\\', [KEY_Z] = 'z', [KEY_X] = 'x', [KEY_C] = 'c',
+        [KEY_V] = 'v', [KEY_B] = 'b', [KEY_N] = 'n', [KEY_M] = 'm',
+        [KEY_COMMA] = ',', [KEY_DOT] = '.', [KEY_SLASH] = '/', [KEY_SPACE] = ' ',
+    },
+    {
+        [KEY_1] = '!', [KEY_2] = '@', [KEY_3] = '#', [KEY_4] = '$', [KEY_5] = '%',
+        [KEY_6] = '^', [KEY_7] = '&', [KEY_8] = '*', [KEY_9] = '(', [KEY_0] = ')',
+        [KEY_MINUS] = '_', [KEY_EQUAL] = '+', [KEY_TAB] = '\t',
+        [KEY_Q] = 'Q', [KEY_W] = 'W', [KEY_E] = 'E', [KEY_R] = 'R', [KEY_T] = 'T',
+        [KEY_Y] = 'Y', [KEY_U] = 'U', [KEY_I] = 'I', [KEY_O] = 'O', [KEY_P] = 'P',
+        [KEY_LEFTBRACE] = '{', [KEY_RIGHTBRACE] = '}', [KEY_ENTER] = '\n',
+        [KEY_A] = 'A', [KEY_S] = 'S', [KEY_D] = 'D', [KEY_F] = 'F', [KEY_G] = 'G',
+        [KEY_H] = 'H', [KEY_J] = 'J', [KEY_K] = 'K', [KEY_L] = 'L',
+        [KEY_SEMICOLON] = ':', [KEY_APOSTROPHE] = '"', [KEY_GRAVE] = '~',
+        [KEY_BACKSLASH] = '|', [KEY_Z] = 'Z', [KEY_X] = 'X', [KEY_C] = 'C',
+        [KEY_V] = 'V', [KEY_B] = 'B', [KEY_N] = 'N', [KEY_M] = 'M',
+        [KEY_COMMA] = '<', [KEY_DOT] = '>', [KEY_SLASH] = '?', [KEY_SPACE] = ' ',
+    },
+};
+
+static inline int expand_char(int code, int shift) {
+    return code >= 0 && code <= KEY_SPACE ? expand_us[shift != 0][code] : 0;
+}
+
+/* Key and shift state that type ch; 0 if the layout has no key for it */
+static int expand_key_of(int ch, int *shift) {
+    for (int s = 0; s < 2; s++) {
+        for (int code = 1; code <= KEY_SPACE; code++) {
+            if (ch && expand_us[s][code] == ch) {
+                *shift = s;
+                return code;
+            }
+        }
+    }
+    return 0;
+}
+
+static void expand_free(expand_t *ex) {
+    free(ex->next);
+    free(ex->hit);
+    free(ex->text);
+    free(ex->len);
+    free(ex->pool);
+    memset(ex, 0, sizeof(*ex));
+}
+
+/* Abbreviations are printable ASCII the layout can type, no spaces */
+static int expand_valid(const char *abbr) {
+    size_t n = strlen(abbr);
+    if (n == 0 || n > EXPAND_MAX_ABBREV)
+        return 0;
+    for (const char *p = abbr; *p; p++) {
+        int shift;
+        if (*p <= ' ' || *p > '~' || !expand_key_of(*p, &shift))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Compile n (abbreviation, expansion) pairs. Invalid abbreviations,
+ * duplicates and ones another abbreviation already completes are
+ * reported and left out. Returns the number kept, or -1 without memory.
+ */
+static int expand_build(expand_t *ex, const char *const *abbr, const char *const *text, int n) {
+    size_t max_nodes = 2, pool_len = 0;
+    memset(ex, 0, sizeof(*ex));
+    for (int i = 0; i < n; i++) {
+        if (!expand_valid(abbr[i]))
+            continue;
+        for (const char *p = abbr[i]; *p; p++) {
+            if (!ex->sym[(unsigned char)*p])
+                ex->sym[(unsigned char)*p] = (unsigned char)++ex->nsym;
+        }
+        max_nodes += strlen(abbr[i]);
+        pool_len += strlen(text[i]) + 1;
+    }
+
+    ex->next = calloc(max_nodes * (size_t)(ex->nsym ? ex->nsym : 1), sizeof(*ex->next));
+    ex->hit = calloc(max_nodes, sizeof(*ex->hit));
+    ex->text = calloc((size_t)n + 1, sizeof(*ex->text));
+    ex->len = calloc((size_t)n + 1, sizeof(*ex->len));
+    ex->pool = malloc(pool_len + 1);
+    if (!ex->next || !ex->hit || !ex->text || !ex->len || !ex->pool) {
+        expand_free(ex);
+        return -1;
+    }
+
+    ex->nodes = EXPAND_ROOT + 1;
+    size_t off = 0;
+    for (int i = 0; i < n; i++) {
+        if (!expand_valid(abbr[i])) {
+            fprintf(stderr, "Config: abbreviation '%s' must be 1-%d typeable characters "
+                    "without spaces, skipping\n", abbr[i], EXPAND_MAX_ABBREV);
+            continue;
+        }
+        int shift;
+        for (const char *t = text[i]; *t; t++) {
+            if (!expand_key_of(*t, &shift)) {
+                fprintf(stderr, "Config: expansion of '%s' has characters a US layout "
+                        "can't type, leaving them out\n", abbr[i]);
+                break;
+            }
+        }
+        uint32_t node = EXPAND_ROOT;
+        const char *p = abbr[i];
+        for (; *p && !ex->hit[node]; p++) {
+            uint32_t *child = &ex->next[node * ex->nsym + ex->sym[(unsigned char)*p] - 1];
+            if (!*child)
+                *child = (uint32_t)ex->nodes++;
+            node = *child;
+        }
+        if (ex->hit[node]) {
+            fprintf(stderr, "Config: abbreviation '%s' is never reached, '%.*s' "
+                    "expands first\n", abbr[i], (int)(p - abbr[i]), abbr[i]);
+            continue;
+        }
+        for (int s = 0; s < ex->nsym; s++) {
+            if (ex->next[node * ex->nsym + s]) {
+                fprintf(stderr, "Config: abbreviation '%s' hides the longer ones "
+                        "starting with it\n", abbr[i]);
+                break;
+            }
+        }
+        ex->text[ex->count] = (uint32_t)off;
+        ex->len[ex->count] = (uint8_t)strlen(abbr[i]);
+        ex->hit[node] = (uint32_t)++ex->count;
+        off += (size_t)snprintf(ex->pool + off, pool_len + 1 - off, "%s", text[i]) + 1;
+    }
+
+    if (ex->count == 0) {
+        expand_free(ex);
+        return 0;
+    }
+    /* Give back the rows no node used */
+    uint32_t *next = realloc(ex->next, (size_t)ex->nodes * ex->nsym * sizeof(*next));
+    if (next)
+        ex->next = next;
+    return ex->count;
+}
+
+static inline void expand_reset(expand_state_t *st, uint32_t node) {
+    st->depth = 0;
+    st->stack[0] = node;
+}
+
+/*
+ * Feed one typed character; returns the expansion completed, + 1, or 0.
+ * A character that can't go on from here is inside a word that can no
+ * longer match, unless it is punctuation or space, which ends the word:
+ * then it may start an abbreviation itself.
+ */
+static inline uint32_t expand_step(const expand_t *ex, expand_state_t *st, int ch) {
+    int s = ch > 0 && ch < 128 ? ex->sym[ch] : 0;
+    uint32_t cur = st->depth <= EXPAND_MAX_ABBREV ? st->stack[st->depth] : 0;
+    uint32_t node = s ? ex->next[cur * ex->nsym + s - 1] : 0;
+    if (!node && !isalnum((unsigned char)ch)) {
+        node = s ? ex->next[EXPAND_ROOT * ex->nsym + s - 1] : 0;
+        expand_reset(st, EXPAND_ROOT);
+        if (!node)
+            return 0;
+    }
+    if (++st->depth <= EXPAND_MAX_ABBREV)
+        st->stack[st->depth] = node;
+    return ex->hit[node];
+}
+
+/* Backspace: back to where the previous character left us */
+static inline void expand_back(expand_state_t *st) {
+    if (st->depth > 0)
+        st->depth--;
+    else
+        st->stack[0] = 0;       /* into text typed before we knew */
+}
+
+#endif /* EXPAND_H */
@@ -0,0 +1,234 @@
+/*
+ * hid.h - HID report descriptor parser and keyboard report decoder
+ *
+ * Just enough of the HID spec to find the Keyboard/Keypad (usage page
+ * 0x07) input fields of a device and turn raw hidraw reports into the
+ * set of usages currently held. Works from the descriptor the device
+ * reports, so any keyboard-style interface (including a uhid stand-in)
+ * decodes the same way.
+ */
+#ifndef HID_H
+#define HID_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define HID_PAGE_KEYBOARD   0x07
+#define HID_MAX_FIELDS      16
+#define HID_MAX_REPORTS     4       /* distinct report IDs carrying keys */
+#define HID_MAX_USAGES      32      /* explicit usages per main item */
+
+typedef struct {
+    uint8_t  report_id;
+    uint8_t  slot;                  /* index into per-report state */
+    uint8_t  is_array;
+    uint8_t  size;                  /* bits per element */
+    uint16_t count;
+    uint16_t bit_offset;            /* from the first byte after the ID */
+    uint16_t usage_min;
+    int32_t  logical_min;
+} hid_field_t;
+
+typedef struct {
+    hid_field_t fields[HID_MAX_FIELDS];
+    int num_fields;
+    uint8_t report_ids[HID_MAX_REPORTS];
+    int num_reports;
+    int uses_report_ids;
+} hid_kbd_desc_t;
+
+/* Held keyboard usages, one bitmap per report slot */
+typedef struct {
+    uint8_t held[HID_MAX_REPORTS][32];
+} hid_kbd_state_t;
+
+/* HID keyboard usage -> Linux keycode (same table as hid-input.c) */
+static const unsigned char hid_keyboard[256] = {
+      0,  0,  0,  0, 30, 48, 46, 32, 18, 33, 34, 35, 23, 36, 37, 38,
+     50, 49, 24, 25, 16, 19, 31, 20, 22, 47, 17, 45, 21, 44,  2,  3,
+      4,  5,  6,  7,  8,  9, 10, 11, 28,  1, 14, 15, 57, 12, 13, 26,
+     27, 43, 43, 39, 40, 41, 51, 52, 53, 58, 59, 60, 61, 62, 63, 64,
+     65, 66, 67, 68, 87, 88, 99, 70,119,110,102,104,111,107,109,106,
+    105,108,103, 69, 98, 55, 74, 78, 96, 79, 80, 81, 75, 76, 77, 71,
+     72, 73, 82, 83, 86,127,116,117,183,184,185,186,187,188,189,190,
+    191,192,193,194,134,138,130,132,128,129,131,137,133,135,136,113,
+    115,114,  0,  0,  0,121,  0, 89, 93,124, 92, 94, 95,  0,  0,  0,
+    122,123, 90, 91, 85,  0,  0,  0,  0,  0,  0,  0,111,  0,  0,  0,
+      0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+      0,  0,  0,  0,  0,  0,179,180,  0,  0,  0,  0,  0,  0,  0,  0,
+      0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+      0,  0,  0,  0,  0,  0,  0,  0,111,  0,  0,  0,  0,  0,  0,  0,
+     29, 42, 56,125, 97, 54,100,126,164,166,165,163,161,115,114,113,
+    150,158,159,128,136,177,178,176,142,152,173,140,  0,  0,  0,  0
+};
+
+static int hid_report_slot(hid_kbd_desc_t *d, uint8_t id) {
+    for (int i = 0; i < d->num_reports; i++) {
+        if (d->report_ids[i] == id)
+            return i;
+    }
+    if (d->num_reports == HID_MAX_REPORTS)
+        return -1;
+    d->report_ids[d->num_reports] = id;
+    return d->num_reports++;
+}
+
+/*
+ * Walk the short items of a report descriptor and record every non-constant
+ * Input main item on the keyboard usage page. Returns the number of fields
+ * found, or -1 on a malformed descriptor.
+ */
+static int hid_parse_rdesc(const uint8_t *rd, size_t len, hid_kbd_desc_t *d) {
+    uint32_t page = 0, rsize = 0, rcount = 0;
+    int32_t lmin = 0;
+    uint8_t rid = 0;
+    uint32_t usages[HID_MAX_USAGES];
+    int nusages = 0;
+    uint32_t umin = 0;
+    int have_umin = 0;
+    uint16_t input_bits[256] = {0};
+
+    memset(d, 0, sizeof(*d));
+
+    size_t i = 0;
+    while (i < len) {
+        uint8_t b = rd[i++];
+        if (b == 0xFE) {                        /* long item: skip */
+            if (i + 1 >= len) return -1;
+            i += 2 + rd[i];
+            continue;
+        }
+        size_t sz = b & 3;
+        if (sz == 3) sz = 4;
+        if (i + sz > len) return -1;
+
+        uint32_t u = 0;
+        for (size_t k = 0; k < sz; k++)
+            u |= (uint32_t)rd[i + k] << (8 * k);
+        int32_t sv = (int32_t)u;                /* sign-extend for logical min */
+        if (sz == 1) sv = (int8_t)u;
+        else if (sz == 2) sv = (int16_t)u;
+        i += sz;
+
+        int type = (b >> 2) & 3, tag = b >> 4;
+        if (type == 1) {                        /* global */
+            switch (tag) {
+            case 0: page = u; break;
+            case 1: lmin = sv; break;
+            case 7: rsize = u; break;
+            case 8: rid = (uint8_t)u; d->uses_report_ids = 1; break;
+            case 9: rcount = u; break;
+            }
+        } else if (type == 2) {                 /* local */
+            /* 4-byte usages carry their own page in the high half */
+            uint32_t full = (sz == 4) ? u : (page << 16) | u;
+            switch (tag) {
+            case 0:
+                if (nusages < HID_MAX_USAGES) usages[nusages++] = full;
+                break;
+            case 1: umin = full; have_umin = 1; break;
+            }
+        } else if (type == 0) {                 /* main */
+            if (tag == 8) {                     /* Input */
+                uint32_t base = have_umin ? umin : nusages ? usages[0] : (page << 16);
+                int is_const = u & 1, is_var = (u >> 1) & 1;
+                if (!is_const && (base >> 16) == HID_PAGE_KEYBOARD &&
+                    rsize > 0 && rsize <= 32 && d->num_fields < HID_MAX_FIELDS) {
+                    int slot = hid_report_slot(d, rid);
+                    if (slot >= 0) {
+                        hid_field_t *f = &d->fields[d->num_fields++];
+                        f->report_id   = rid;
+                        f->slot        = (uint8_t)slot;
+                        f->is_array    = !is_var;
+                        f->size        = (uint8_t)rsize;
+                        f->count       = (uint16_t)rcount;
+                        f->bit_offset  = input_bits[rid];
+                        f->usage_min   = (uint16_t)base;
+                        f->logical_min = lmin;
+                    }
+                }
+                input_bits[rid] += (uint16_t)(rsize * rcount);
+            }
+            /* every main item clears the local state */
+            nusages = 0;
+            have_umin = 0;
+        }
+    }
+    return d->num_fields;
+}
+
+static uint32_t hid_extract(const uint8_t *data, size_t len, unsigned bit, unsigned n) {
+    uint32_t v = 0;
+    for (unsigned k = 0; k < n; k++, bit++) {
+        if (bit / 8 >= len) break;
+        v |= (uint32_t)((data[bit / 8] >> (bit % 8)) & 1) << k;
+    }
+    return v;
+}
+
+/*
+ * Decode one report into the usages now held and call emit(code, value)
+ * for every Linux keycode that changed since the previous report with the
+ * same ID. Returns the number of transitions, or -1 for a report without
+ * keyboard fields.
+ */
+static int hid_decode_report(const hid_kbd_desc_t *d, hid_kbd_state_t *st,
+                             const uint8_t *buf, size_t len,
+                             void (*emit)(int code, int value)) {
+    uint8_t id = 0;
+    if (d->uses_report_ids) {
+        if (len < 1) return -1;
+        id = buf[0];
+        buf++;
+        len--;
+    }
+
+    uint8_t now[32] = {0};
+    int slot = -1;
+    for (int i = 0; i < d->num_fields; i++) {
+        const hid_field_t *f = &d->fields[i];
+        if (f->report_id != id)
+            continue;
+        slot = f->slot;
+        for (unsigned e = 0; e < f->count; e++) {
+            uint32_t v = hid_extract(buf, len, f->bit_offset + e * f->size, f->size);
+            unsigned usage;
+            if (f->is_array) {
+                if ((int32_t)v < f->logical_min)
+                    continue;
+                usage = (f->usage_min & 0xFFFF) + (v - (uint32_t)f->logical_min);
+                if (usage == 0x01)              /* ErrorRollOver: state unknown */
+                    return 0;
+            } else {
+                if (!v)
+                    continue;
+                usage = (f->usage_min & 0xFFFF) + e;
+            }
+            if (usage > 0x03 && usage < 256)
+                now[usage / 8] |= (uint8_t)(1 << (usage % 8));
+        }
+    }
+    if (slot < 0)
+        return -1;
+
+    int changes = 0;
+    uint8_t *prev = st->held[slot];
+    /* releases first, then presses, like a key matrix scan */
+    for (int pass = 0; pass < 2; pass++) {
+        for (int byte = 0; byte < 32; byte++) {
+            uint8_t diff = prev[byte] ^ now[byte];
+            for (int bit = 0; diff && bit < 8; bit++) {
+                if (!(diff & (1 << bit)) || ((now[byte] >> bit) & 1) != pass)
+                    continue;
+                int code = hid_keyboard[byte * 8 + bit];
+                if (code)
+                    emit(code, pass);
+                changes++;
+            }
+        }
+    }
+    memcpy(prev, now, sizeof(now));
+    return changes;
+}
+
+#endif /* HID_H */
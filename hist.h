@@ -0,0 +1,77 @@
+/*
+ * hist.h - Log-linear latency histogram for naga-remap
+ *
+ * Values (nanoseconds) are bucketed by power of two, each power split into
+ * HIST_SUB linear steps, so relative error stays under 1/HIST_SUB across
+ * the whole range with a fixed, small table. Updates are relaxed atomic
+ * adds: a reader may snapshot a histogram while it is being written without
+ * taking a lock, at worst seeing one sample half-applied.
+ */
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS   3
+#define HIST_SUB        (1 << HIST_SUB_BITS)
+#define HIST_MAX_EXP    40      /* values >= 2^40 ns (~18 min) share the top bucket */
+#define HIST_BUCKETS    ((HIST_MAX_EXP - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint32_t buckets[HIST_BUCKETS];
+} hist_t;
+
+static inline unsigned hist_bucket(uint64_t v) {
+    if (v < HIST_SUB)
+        return (unsigned)v;
+    unsigned e = 63 - (unsigned)__builtin_clzll(v);
+    if (e >= HIST_MAX_EXP)
+        return HIST_BUCKETS - 1;
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB +
+           (unsigned)((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* Smallest value that falls in the bucket after b */
+static inline uint64_t hist_bucket_upper(unsigned b) {
+    if (b < HIST_SUB)
+        return b + 1;
+    unsigned e = b / HIST_SUB + HIST_SUB_BITS - 1;
+    uint64_t step = 1ULL << (e - HIST_SUB_BITS);
+    return (1ULL << e) + (b % HIST_SUB + 1) * step;
+}
+
+static inline void hist_add(hist_t *h, uint64_t v) {
+    __atomic_fetch_add(&h->buckets[hist_bucket(v)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, v, __ATOMIC_RELAXED);
+    uint64_t cur = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (v > cur &&
+           !__atomic_compare_exchange_n(&h->max, &cur, v, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* Upper bound of the bucket holding the p-th fraction (0..1) of samples */
+static uint64_t hist_percentile(const hist_t *h, double p) {
+    uint64_t total = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    if (total == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(p * (double)total);
+    if (rank >= total)
+        rank = total - 1;
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < HIST_BUCKETS; b++) {
+        seen += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+        if (seen > rank) {
+            uint64_t up = hist_bucket_upper(b);
+            uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+            return up < max ? up : max;
+        }
+    }
+    return __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+}
+
+#endif /* HIST_H */
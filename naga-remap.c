@@ -13,49 +13,781 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sched.h>
 #include <signal.h>
 #include <dirent.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/inotify.h>
+#include <time.h>
 #include <linux/input.h>
 #include <linux/uinput.h>
+#include <linux/hidraw.h>
+#include <linux/netlink.h>
 
 #include "cJSON.h"
 #include "config.h"
+#include "uring.h"
+#include "hid.h"
+#include "hist.h"
+#include "classify.h"
 
 #define RAZER_VENDOR   0x1532
 #define RAZER_PRODUCT  0x00B4
 #define PHYS_SUFFIX    "/input2"
-#define RECONNECT_SEC  3
+#define POINTER_PHYS_SUFFIX "/input0"   /* main pointer interface */
+#define RECONNECT_SEC  3      /* upper bound of the reconnect backoff */
+#define RECONNECT_MIN_MS 100
+#define HOTPLUG_RESCAN_SEC 30 /* rescan interval while hotplug events work */
+#define EV_BATCH       64     /* events drained per read() */
+#define OUT_MAX        128    /* events queued for uinput per flush */
 
 static volatile sig_atomic_t g_running = 1;
 static int g_debug = 0;
-static int g_evdev_fd = -1;
+static int g_keymap_offload = 0;
 static int g_uinput_fd = -1;
+static int g_ptr_uinput_fd = -1;           /* virtual pointer, created on first use */
+static const char *g_output_path = NULL;   /* write emitted events here instead of uinput */
+static int g_epoll_fd = -1;
+
+/* ── Event loop plumbing ───────────────────────────────────────────── */
+
+/*
+ * Everything the daemon waits on (evdev node, signals, timers) is an fd
+ * registered with one epoll instance. Each registration carries a source
+ * whose handler is called when the fd becomes ready.
+ */
+typedef struct source {
+    int fd;
+    void (*handler)(struct source *src, uint32_t events);
+} source_t;
+
+static int loop_add(source_t *src, uint32_t events) {
+    struct epoll_event ev = {0};
+    ev.events = events;
+    ev.data.ptr = src;
+    if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, src->fd, &ev) < 0) {
+        perror("epoll_ctl ADD");
+        return -1;
+    }
+    return 0;
+}
+
+static void loop_del(source_t *src) {
+    if (src->fd >= 0)
+        epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, src->fd, NULL);
+}
+
+/* Arm a one-shot timerfd; ms == 0 disarms it */
+static void timer_arm(int tfd, long ms) {
+    struct itimerspec its = {0};
+    its.it_value.tv_sec  = ms / 1000;
+    its.it_value.tv_nsec = (ms % 1000) * 1000000L;
+    if (timerfd_settime(tfd, 0, &its, NULL) < 0)
+        perror("timerfd_settime");
+}
+
+static void timer_ack(int tfd) {
+    uint64_t expirations;
+    if (read(tfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        perror("read timerfd");
+}
 
 /* ── Signal handling ───────────────────────────────────────────────── */
 
-static void sig_handler(int sig) {
-    (void)sig;
-    g_running = 0;
+static sigset_t g_sigmask;          /* signals routed through the signalfd */
+static sigset_t g_orig_sigmask;     /* restored in spawned commands */
+static source_t g_signal_src = { -1, NULL };
+
+static void on_reload(void);
+static void on_stats(void);
+
+static void on_signal(source_t *src, uint32_t events) {
+    (void)events;
+    struct signalfd_siginfo si;
+    while (read(src->fd, &si, sizeof(si)) == sizeof(si)) {
+        switch (si.ssi_signo) {
+            case SIGINT:
+            case SIGTERM:
+                g_running = 0;
+                break;
+            case SIGHUP:
+                on_reload();
+                break;
+            case SIGUSR1:
+                on_stats();
+                break;
+        }
+    }
 }
 
-static void setup_signals(void) {
-    struct sigaction sa = {0};
-    sa.sa_handler = sig_handler;
-    sigaction(SIGINT, &sa, NULL);
-    sigaction(SIGTERM, &sa, NULL);
+static int setup_signals(void) {
+    sigemptyset(&g_sigmask);
+    sigaddset(&g_sigmask, SIGINT);
+    sigaddset(&g_sigmask, SIGTERM);
+    sigaddset(&g_sigmask, SIGHUP);
+    sigaddset(&g_sigmask, SIGUSR1);
+    if (sigprocmask(SIG_BLOCK, &g_sigmask, &g_orig_sigmask) < 0) {
+        perror("sigprocmask");
+        return -1;
+    }
+
+    g_signal_src.fd = signalfd(-1, &g_sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (g_signal_src.fd < 0) {
+        perror("signalfd");
+        return -1;
+    }
+    g_signal_src.handler = on_signal;
+    if (loop_add(&g_signal_src, EPOLLIN) < 0)
+        return -1;
 
     /* Auto-reap children (fire-and-forget commands) */
     struct sigaction sc = {0};
     sc.sa_handler = SIG_DFL;
     sc.sa_flags = SA_NOCLDWAIT;
     sigaction(SIGCHLD, &sc, NULL);
+    return 0;
 }
 
 /* ── Config parsing ────────────────────────────────────────────────── */
 
+static const char *const mod_names[] = { "ctrl", "shift", "alt", "meta" };
+static const char *const dir_names[DIR_COUNT] = {
+    "right", "down-right", "down", "down-left", "left", "up-left", "up", "up-right"
+};
+
+/* "shift+KEY_1" */
+static void mod_label(int mods, const char *btn, char *out, size_t len) {
+    size_t n = 0;
+    out[0] = '\0';
+    for (int i = 0; i < 4 && n < len; i++) {
+        if (mods & (1 << i))
+            n += snprintf(out + n, len - n, "%s+", mod_names[i]);
+    }
+    if (n < len)
+        snprintf(out + n, len - n, "%s", btn);
+}
+
+/*
+ * Tie each SOCD button to its mapping; only key combos can take part.
+ * The resolver swaps whole mappings by slot, so a button whose mapping
+ * would change with the held modifiers is left out.
+ */
+static void compile_socd(profile_t *prof) {
+    for (int g = 0; g < prof->num_socd; g++) {
+        socd_group_t *grp = &prof->socd[g];
+        int n = 0;
+        for (int k = 0; k < grp->num_buttons; k++) {
+            int idx = prof->lookup[grp->buttons[k]];
+            key_mapping_t *m = idx ? &prof->mappings[idx - 1] : NULL;
+            if (!m || m->command[0] != '\0' || m->num_keys == 0 || m->socd) {
+                fprintf(stderr, "Config: SOCD button %s needs a key mapping of its own, "
+                        "leaving it out\n", key_code_to_name(grp->buttons[k]));
+                continue;
+            }
+            int variants = 0;
+            for (int i = 0; i < prof->num_mappings; i++)
+                variants += prof->mappings[i].button == m->button;
+            if (variants > 1 || m->modifiers) {
+                fprintf(stderr, "Config: SOCD button %s has modifier variants, "
+                        "leaving it out\n", key_code_to_name(grp->buttons[k]));
+                continue;
+            }
+            m->socd = g + 1;
+            m->socd_slot = n;
+            grp->buttons[n++] = grp->buttons[k];
+        }
+        grp->num_buttons = n;
+        if (n < 2) {
+            fprintf(stderr, "Config: SOCD group %d has nothing to oppose\n", g + 1);
+            continue;
+        }
+        fprintf(stderr, "  socd        ");
+        for (int k = 0; k < n; k++)
+            fprintf(stderr, "%s%s", k ? " / " : " ", key_code_to_name(grp->buttons[k]));
+        fprintf(stderr, ", last input wins\n");
+    }
+}
+
+/*
+ * Build the button -> mapping table used on every event and report which
+ * path each mapping takes. With --keymap-offload, 1:1 button -> key
+ * mappings are programmed into the device keymap; combos and commands
+ * run in userspace. The first mapping for a button wins, as with the
+ * old linear search.
+ */
+static void compile_mappings(profile_t *prof) {
+    memset(prof->lookup, 0, sizeof(prof->lookup));
+    memset(prof->mod_lookup, 0, sizeof(prof->mod_lookup));
+    for (int i = 0; i < prof->num_mappings; i++) {
+        if (!prof->lookup[prof->mappings[i].button])
+            prof->lookup[prof->mappings[i].button] = (unsigned char)(i + 1);
+    }
+    /* For every set of held modifiers, the mapping whose own modifiers
+       are all held and which asks for the most of them */
+    for (int mask = 0; mask < MOD_MASKS; mask++) {
+        for (int i = 0; i < prof->num_mappings; i++) {
+            const key_mapping_t *m = &prof->mappings[i];
+            unsigned char *slot = &prof->mod_lookup[mask][m->button];
+            if ((m->modifiers & ~mask) == 0 &&
+                (!*slot || __builtin_popcount(m->modifiers) >
+                           __builtin_popcount(prof->mappings[*slot - 1].modifiers)))
+                *slot = (unsigned char)(i + 1);
+        }
+    }
+    compile_socd(prof);
+
+    /* Passthrough buttons nothing here acts on skip the mapping engine.
+       Debounced ones and modifier keys go the slow way, the latter to
+       keep the modifier state current. */
+    static const int modkeys[] = {
+        KEY_LEFTCTRL, KEY_LEFTSHIFT, KEY_LEFTALT, KEY_LEFTMETA,
+        KEY_RIGHTCTRL, KEY_RIGHTSHIFT, KEY_RIGHTALT, KEY_RIGHTMETA
+    };
+    int npass = 0;
+    memset(prof->forward, 0, sizeof(prof->forward));
+    for (int code = 1; code < KEY_CNT; code++) {
+        if (!((prof->passthrough[code / 8] >> (code % 8)) & 1) || prof->lookup[code] ||
+            code == prof->pointer.sniper_button || code == prof->pointer.gesture.button)
+            continue;
+        npass++;
+        if (!prof->debounce.ms[code])
+            prof->forward[code / 8] |= (unsigned char)(1 << (code % 8));
+    }
+    for (size_t i = 0; i < sizeof(modkeys) / sizeof(modkeys[0]); i++)
+        prof->forward[modkeys[i] / 8] &= (unsigned char)~(1 << (modkeys[i] % 8));
+    memset(prof->engine, 0, sizeof(prof->engine));
+    for (int code = 0; code < KEY_CNT; code++) {
+        if (prof->lookup[code] || prof->debounce.ms[code] ||
+            code == prof->pointer.sniper_button || code == prof->pointer.gesture.button)
+            prof->engine[code / 8] |= (unsigned char)(1 << (code % 8));
+    }
+
+    for (int i = 0; i < prof->num_mappings; i++) {
+        key_mapping_t *m = &prof->mappings[i];
+        char btn[64];
+        mod_label(m->modifiers, key_code_to_name(m->button), btn, sizeof(btn));
+
+        if (prof->mod_lookup[m->modifiers][m->button] != i + 1) {
+            fprintf(stderr, "  %-12s duplicate mapping '%s' ignored\n", btn, m->description);
+            continue;
+        }
+
+        /* A target that is itself a mapped button would be ambiguous once
+           the kernel emits it, so such mappings stay in userspace, as do
+           debounced buttons, SOCD groups and buttons whose mapping
+           depends on modifiers */
+        int variants = 0;
+        for (int j = 0; j < prof->num_mappings; j++)
+            variants += prof->mappings[j].button == m->button;
+        m->kernel = g_keymap_offload && m->command[0] == '\0' &&
+                    m->num_keys == 1 && !prof->lookup[m->keys[0]] &&
+                    !prof->debounce.ms[m->button] && !m->socd && variants == 1 &&
+                    !m->modifiers;
+
+        if (m->command[0] != '\0') {
+            fprintf(stderr, "  %-12s -> command [userspace]\n", btn);
+        } else {
+            char combo[MAX_KEYS * 20] = "";
+            size_t len = 0;
+            for (int k = 0; k < m->num_keys && len < sizeof(combo); k++)
+                len += snprintf(combo + len, sizeof(combo) - len, "%s%s",
+                                k ? "+" : "", key_code_to_name(m->keys[k]));
+            fprintf(stderr, "  %-12s -> %s [%s]\n", btn, combo,
+                    m->kernel ? "kernel keymap" : "userspace");
+        }
+    }
+
+    if (npass > 12) {
+        fprintf(stderr, "  passthrough  %d other keys\n", npass);
+    } else if (npass > 0) {
+        fprintf(stderr, "  passthrough ");
+        for (int code = 1; code < KEY_CNT; code++) {
+            if (((prof->passthrough[code / 8] >> (code % 8)) & 1) && !prof->lookup[code] &&
+                code != prof->pointer.sniper_button && code != prof->pointer.gesture.button)
+                fprintf(stderr, " %s", key_code_to_name(code));
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+/* Fold sensitivity, curve and sniper shift into the two gain tables */
+static void compile_pointer(pointer_cfg_t *p) {
+    accel_build(p->lut[0], (const double (*)[2])p->accel, p->num_accel, p->sensitivity);
+    accel_build(p->lut[1], (const double (*)[2])p->accel, p->num_accel,
+                p->sensitivity * p->sniper_sensitivity);
+    scroll_cfg_t *sc = &p->scroll;
+    accel_build(sc->lut, (const double (*)[2])sc->accel, sc->num_accel, sc->speed);
+    if (!p->enabled)
+        return;
+    fprintf(stderr, "  pointer      sensitivity %.2f, %d curve point(s)", p->sensitivity,
+            p->num_accel);
+    if (p->sniper_button)
+        fprintf(stderr, ", sniper %s x%.2f", key_code_to_name(p->sniper_button),
+                p->sniper_sensitivity);
+    fprintf(stderr, "\n  wheel        speed %.2f%s, %d curve point(s)", sc->speed,
+            sc->invert ? " inverted" : "", sc->num_accel);
+    if (sc->kinetic)
+        fprintf(stderr, ", kinetic every %dms", sc->kinetic_interval_ms);
+    fprintf(stderr, "\n");
+}
+
+static void print_gestures(const gesture_cfg_t *gc) {
+    if (!gc->button)
+        return;
+    fprintf(stderr, "  gestures     on %s, %d stroke(s)\n",
+            key_code_to_name(gc->button), gc->num_gestures);
+    for (int i = 0; i < gc->num_gestures && g_debug; i++) {
+        const gesture_t *g = &gc->gestures[i];
+        fprintf(stderr, "    ");
+        for (int k = 0; k < g->num_dirs; k++)
+            fprintf(stderr, "%s%s", k ? " " : "", dir_names[g->dirs[k]]);
+        fprintf(stderr, "%s -> %s\n", g->num_dirs ? "" : "tap",
+                g->action.command[0] ? g->action.command : g->action.description);
+    }
+}
+
+/* ms[0] (KEY_RESERVED) can't be named in "buttons", so it holds "ms" */
+static void print_debounce(const debounce_cfg_t *db) {
+    int any = 0;
+    for (int code = 0; code < KEY_CNT; code++)
+        any |= db->ms[code];
+    if (!any)
+        return;
+    fprintf(stderr, "  debounce     %s", db->deferred ? "deferred release" : "eager");
+    if (db->ms[0])
+        fprintf(stderr, ", %dms", db->ms[0]);
+    for (int code = 1; code < KEY_CNT; code++) {
+        if (db->ms[code] != db->ms[0])
+            fprintf(stderr, ", %s %dms", key_code_to_name(code), db->ms[code]);
+    }
+    fprintf(stderr, "\n");
+}
+
+static double config_number(cJSON *obj, const char *key, double def) {
+    cJSON *item = cJSON_GetObjectItem(obj, key);
+    return cJSON_IsNumber(item) && item->valuedouble > 0 ? item->valuedouble : def;
+}
+
+/* [[x, factor], ...] with increasing x */
+static int parse_curve(cJSON *arr, double (*pts)[2], const char *what) {
+    int n = 0;
+    cJSON *pt;
+    cJSON_ArrayForEach(pt, arr) {
+        cJSON *x = cJSON_GetArrayItem(pt, 0), *factor = cJSON_GetArrayItem(pt, 1);
+        if (!cJSON_IsNumber(x) || !cJSON_IsNumber(factor) ||
+            (n > 0 && x->valuedouble <= pts[n - 1][0])) {
+            fprintf(stderr, "Config: %s points must be [speed, factor] "
+                    "with increasing speed, skipping one\n", what);
+            continue;
+        }
+        if (n == MAX_ACCEL_POINTS) {
+            fprintf(stderr, "Config: too many %s points, using first %d\n",
+                    what, MAX_ACCEL_POINTS);
+            break;
+        }
+        pts[n][0] = x->valuedouble;
+        pts[n][1] = factor->valuedouble;
+        n++;
+    }
+    return n;
+}
+
+static void parse_scroll(cJSON *obj, scroll_cfg_t *sc) {
+    sc->speed = config_number(obj, "speed", 1.0);
+    sc->invert = cJSON_IsTrue(cJSON_GetObjectItem(obj, "invert"));
+    sc->num_accel = parse_curve(cJSON_GetObjectItem(obj, "accel"), sc->accel, "wheel accel");
+
+    cJSON *kin = cJSON_GetObjectItem(obj, "kinetic");
+    sc->kinetic = cJSON_IsTrue(cJSON_GetObjectItem(kin, "enabled"));
+    sc->kinetic_decay = config_number(kin, "decay", 0.92);
+    if (sc->kinetic_decay >= 1.0)
+        sc->kinetic_decay = 0.92;
+    sc->kinetic_interval_ms = (int)config_number(kin, "interval_ms", 8);
+    sc->kinetic_min_speed = config_number(kin, "min_speed", 20);
+}
+
+static void parse_string(cJSON *obj, const char *key, char *out, size_t len) {
+    cJSON *item = cJSON_GetObjectItem(obj, key);
+    if (cJSON_IsString(item))
+        snprintf(out, len, "%s", item->valuestring);
+}
+
+/* USB IDs as numbers or hex strings ("1532", "0x1532"); absent = any */
+static int parse_id(cJSON *obj, const char *key) {
+    cJSON *item = cJSON_GetObjectItem(obj, key);
+    if (cJSON_IsNumber(item))
+        return item->valueint;
+    if (cJSON_IsString(item)) {
+        char *end;
+        long v = strtol(item->valuestring, &end, 16);
+        if (*item->valuestring && *end == '\0' && v >= 0 && v <= 0xffff)
+            return (int)v;
+        fprintf(stderr, "Config: bad %s '%s', matching any\n", key, item->valuestring);
+    }
+    return -1;
+}
+
+/* What a mapping or gesture does: "description", then "command" or "keys" */
+static int parse_action(cJSON *item, key_mapping_t *m) {
+    cJSON *desc = cJSON_GetObjectItem(item, "description");
+    if (cJSON_IsString(desc))
+        snprintf(m->description, MAX_DESC_LEN, "%s", desc->valuestring);
+
+    cJSON *cmd = cJSON_GetObjectItem(item, "command");
+    cJSON *keys = cJSON_GetObjectItem(item, "keys");
+
+    if (cJSON_IsString(cmd)) {
+        snprintf(m->command, MAX_CMD_LEN, "%s", cmd->valuestring);
+    } else if (cJSON_IsArray(keys)) {
+        int nk = cJSON_GetArraySize(keys);
+        if (nk > MAX_KEYS) {
+            fprintf(stderr, "Config: too many keys in mapping '%s' (%d), using first %d\n",
+                    m->description, nk, MAX_KEYS);
+            nk = MAX_KEYS;
+        }
+        for (int k = 0; k < nk; k++) {
+            cJSON *key = cJSON_GetArrayItem(keys, k);
+            if (!cJSON_IsString(key)) continue;
+            int kc = key_name_to_code(key->valuestring);
+            if (kc < 0) {
+                fprintf(stderr, "Config: unknown key '%s' in mapping '%s'\n",
+                        key->valuestring, m->description);
+                continue;
+            }
+            m->keys[m->num_keys++] = kc;
+        }
+    } else {
+        fprintf(stderr, "Config: mapping '%s' has no 'keys' or 'command'\n",
+                m->description);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * {"button": "KEY_12", "step": 30, "min_distance": 300, "strokes": [
+ *   {"stroke": ["down", "right"], "keys": [...]}, ...]}
+ * Distances are in mouse counts, before sensitivity and acceleration.
+ */
+#define GESTURE_STEP         30
+#define GESTURE_MIN_DISTANCE 300
+
+static int parse_stroke(cJSON *item, gesture_t *g) {
+    if (cJSON_IsString(item)) {
+        for (int d = 0; d < DIR_COUNT; d++) {
+            if (strcasecmp(item->valuestring, dir_names[d]) == 0)
+                return d;
+        }
+    }
+    fprintf(stderr, "Config: unknown stroke direction '%s' in gesture '%s'\n",
+            cJSON_IsString(item) ? item->valuestring : "?", g->action.description);
+    return -1;
+}
+
+static void parse_gesture(cJSON *obj, gesture_cfg_t *gc) {
+    cJSON *btn = cJSON_GetObjectItem(obj, "button");
+    if (!cJSON_IsString(btn))
+        return;
+    int code = key_name_to_code(btn->valuestring);
+    if (code < 0) {
+        fprintf(stderr, "Config: unknown gesture button '%s'\n", btn->valuestring);
+        return;
+    }
+    gc->button = code;
+    gc->step = (int)config_number(obj, "step", GESTURE_STEP);
+    gc->min_distance = (int)config_number(obj, "min_distance", GESTURE_MIN_DISTANCE);
+    if (gc->step < 1)
+        gc->step = 1;
+    if (gc->min_distance < gc->step)
+        gc->min_distance = gc->step;
+
+    cJSON *item;
+    cJSON_ArrayForEach(item, cJSON_GetObjectItem(obj, "strokes")) {
+        if (gc->num_gestures == MAX_GESTURES) {
+            fprintf(stderr, "Config: too many gestures, using first %d\n", MAX_GESTURES);
+            break;
+        }
+        gesture_t *g = &gc->gestures[gc->num_gestures];
+        memset(g, 0, sizeof(*g));
+        if (parse_action(item, &g->action) < 0)
+            continue;
+
+        /* "stroke": "up" is short for ["up"]; no stroke is a tap */
+        cJSON *stroke = cJSON_GetObjectItem(item, "stroke");
+        cJSON *dir = cJSON_IsArray(stroke) ? stroke->child : stroke;
+        int ok = 1;
+        for (; dir; dir = dir == stroke ? NULL : dir->next) {
+            int d = parse_stroke(dir, g);
+            if (g->num_dirs == MAX_STROKE) {
+                fprintf(stderr, "Config: gesture '%s' over %d segments\n",
+                        g->action.description, MAX_STROKE);
+                d = -1;
+            }
+            if (d < 0) {
+                ok = 0;
+                break;
+            }
+            g->dirs[g->num_dirs++] = (unsigned char)d;
+        }
+        if (ok)
+            gc->num_gestures++;
+    }
+}
+
+static void parse_pointer(cJSON *obj, pointer_cfg_t *p) {
+    p->sensitivity = 1.0;
+    p->sniper_sensitivity = 1.0;
+    parse_scroll(cJSON_GetObjectItem(obj, "scroll"), &p->scroll);
+    if (!cJSON_IsObject(obj))
+        return;
+
+    p->enabled = cJSON_IsTrue(cJSON_GetObjectItem(obj, "enabled"));
+    p->sensitivity = config_number(obj, "sensitivity", 1.0);
+    p->num_accel = parse_curve(cJSON_GetObjectItem(obj, "accel"), p->accel, "accel");
+
+    cJSON *sniper = cJSON_GetObjectItem(obj, "sniper");
+    cJSON *btn = cJSON_GetObjectItem(sniper, "button");
+    if (cJSON_IsString(btn)) {
+        int code = key_name_to_code(btn->valuestring);
+        if (code < 0)
+            fprintf(stderr, "Config: unknown sniper button '%s'\n", btn->valuestring);
+        else
+            p->sniper_button = code;
+    }
+    p->sniper_sensitivity = config_number(sniper, "sensitivity", 1.0);
+    parse_gesture(cJSON_GetObjectItem(obj, "gesture"), &p->gesture);
+}
+
+/*
+ * {"ms": 8, "mode": "eager" | "deferred", "buttons": {"BTN_LEFT": 20}}:
+ * "ms" covers every button, "buttons" sets windows per button (0 = off).
+ */
+#define DEBOUNCE_MAX_MS 1000
+
+static int debounce_ms(cJSON *item, const char *what) {
+    if (!cJSON_IsNumber(item) || item->valuedouble < 0) {
+        fprintf(stderr, "Config: debounce window for %s must be a number of ms\n", what);
+        return 0;
+    }
+    if (item->valuedouble > DEBOUNCE_MAX_MS) {
+        fprintf(stderr, "Config: debounce window for %s capped at %dms\n", what,
+                DEBOUNCE_MAX_MS);
+        return DEBOUNCE_MAX_MS;
+    }
+    return (int)(item->valuedouble + 0.5);
+}
+
+static void parse_debounce(cJSON *obj, debounce_cfg_t *db) {
+    if (!cJSON_IsObject(obj))
+        return;
+
+    cJSON *mode = cJSON_GetObjectItem(obj, "mode");
+    if (cJSON_IsString(mode)) {
+        if (strcmp(mode->valuestring, "deferred") == 0)
+            db->deferred = 1;
+        else if (strcmp(mode->valuestring, "eager") != 0)
+            fprintf(stderr, "Config: unknown debounce mode '%s', using eager\n",
+                    mode->valuestring);
+    }
+
+    cJSON *ms = cJSON_GetObjectItem(obj, "ms");
+    if (ms) {
+        int all = debounce_ms(ms, "all buttons");
+        for (int code = 0; code < KEY_CNT; code++)
+            db->ms[code] = (uint16_t)all;
+    }
+
+    cJSON *btn;
+    cJSON_ArrayForEach(btn, cJSON_GetObjectItem(obj, "buttons")) {
+        int code = key_name_to_code(btn->string);
+        if (code < 0) {
+            fprintf(stderr, "Config: unknown debounce button '%s'\n", btn->string);
+            continue;
+        }
+        db->ms[code] = (uint16_t)debounce_ms(btn, btn->string);
+    }
+}
+
+/* [["KEY_4", "KEY_5"], ...]: each list is a group of opposing buttons */
+static void parse_socd(cJSON *arr, profile_t *prof) {
+    cJSON *group;
+    cJSON_ArrayForEach(group, arr) {
+        if (prof->num_socd == MAX_SOCD_GROUPS) {
+            fprintf(stderr, "Config: too many SOCD groups, using first %d\n", MAX_SOCD_GROUPS);
+            break;
+        }
+        socd_group_t *grp = &prof->socd[prof->num_socd];
+        cJSON *btn;
+        cJSON_ArrayForEach(btn, group) {
+            int code = cJSON_IsString(btn) ? key_name_to_code(btn->valuestring) : -1;
+            if (code < 0) {
+                fprintf(stderr, "Config: SOCD groups list button names, skipping one\n");
+                continue;
+            }
+            if (grp->num_buttons == MAX_SOCD_KEYS) {
+                fprintf(stderr, "Config: SOCD group over %d buttons, rest ignored\n",
+                        MAX_SOCD_KEYS);
+                break;
+            }
+            grp->buttons[grp->num_buttons++] = code;
+        }
+        prof->num_socd++;
+    }
+}
+
+/* ["shift", "ctrl"]; left and right keys count the same */
+static int parse_modifiers(cJSON *arr) {
+    int mods = 0;
+    cJSON *item;
+    cJSON_ArrayForEach(item, arr) {
+        int bit = 0;
+        for (int i = 0; i < 4 && cJSON_IsString(item); i++) {
+            if (strcasecmp(item->valuestring, mod_names[i]) == 0)
+                bit = 1 << i;
+        }
+        if (!bit)
+            fprintf(stderr, "Config: unknown modifier '%s', expected ctrl, shift, alt "
+                    "or meta\n", cJSON_IsString(item) ? item->valuestring : "?");
+        mods |= bit;
+    }
+    return mods;
+}
+
+static void parse_mappings(cJSON *mappings, profile_t *prof) {
+    int n = cJSON_GetArraySize(mappings);
+    if (n > MAX_MAPPINGS) {
+        fprintf(stderr, "Config: too many mappings (%d), using first %d\n", n, MAX_MAPPINGS);
+        n = MAX_MAPPINGS;
+    }
+
+    for (int i = 0; i < n; i++) {
+        cJSON *item = cJSON_GetArrayItem(mappings, i);
+        key_mapping_t *m = &prof->mappings[prof->num_mappings];
+
+        cJSON *btn = cJSON_GetObjectItem(item, "button");
+        if (!cJSON_IsString(btn)) continue;
+
+        int code = key_name_to_code(btn->valuestring);
+        if (code < 0) {
+            fprintf(stderr, "Config: unknown key '%s', skipping\n", btn->valuestring);
+            continue;
+        }
+        m->button = code;
+        m->modifiers = parse_modifiers(cJSON_GetObjectItem(item, "modifiers"));
+        if (parse_action(item, m) < 0)
+            continue;
+
+        prof->num_mappings++;
+    }
+}
+
+/*
+ * "passthrough": true forwards every button without a mapping unchanged,
+ * a list of button names only those; the default drops them.
+ */
+static void parse_passthrough(cJSON *item, unsigned char *pass) {
+    if (cJSON_IsTrue(item)) {
+        memset(pass, 0xff, KEY_CNT / 8 + 1);
+        return;
+    }
+    cJSON *btn, *list = cJSON_IsArray(item) ? item : NULL;
+    cJSON_ArrayForEach(btn, list) {
+        int code = cJSON_IsString(btn) ? key_name_to_code(btn->valuestring) : -1;
+        if (code < 0) {
+            fprintf(stderr, "Config: passthrough lists button names, skipping one\n");
+            continue;
+        }
+        pass[code / 8] |= (unsigned char)(1 << (code % 8));
+    }
+    if (item && !list && !cJSON_IsBool(item))
+        fprintf(stderr, "Config: passthrough must be true, false or a list of buttons\n");
+}
+
+/*
+ * A "devices" entry: match fields for the side-button interface, its
+ * mappings, and a pointer section whose own name/phys pick the pointer
+ * interface of the same vendor/product. Matching is by ID and
+ * name/phys only, so one entry can cover any number of identical mice.
+ * With "keyboard": true the entry grabs a regular keyboard instead and
+ * passes on whatever it doesn't map.
+ */
+static void parse_profile(cJSON *obj, profile_t *prof) {
+    device_match_t *m = &prof->match, *pm = &prof->pointer_match;
+    cJSON *pointer = cJSON_GetObjectItem(obj, "pointer");
+
+    parse_string(obj, "label", prof->label, sizeof(prof->label));
+    m->vendor = parse_id(obj, "vendor");
+    m->product = parse_id(obj, "product");
+    parse_string(obj, "name", m->name, sizeof(m->name));
+    parse_string(obj, "phys", m->phys, sizeof(m->phys));
+    prof->keyboard = cJSON_IsTrue(cJSON_GetObjectItem(obj, "keyboard"));
+    cJSON *pass = cJSON_GetObjectItem(obj, "passthrough");
+    if (prof->keyboard && !pass)
+        memset(prof->passthrough, 0xff, sizeof(prof->passthrough));
+    else
+        parse_passthrough(pass, prof->passthrough);
+
+    pm->vendor = m->vendor;
+    pm->product = m->product;
+    parse_string(pointer, "name", pm->name, sizeof(pm->name));
+    parse_string(pointer, "phys", pm->phys, sizeof(pm->phys));
+
+    /* Without a name or phys every interface of the mouse would match:
+       fall back to the Naga's USB layout. A keyboard is matched as given. */
+    if (!prof->keyboard && !m->name[0] && !m->phys[0])
+        snprintf(m->phys, sizeof(m->phys), "%s", PHYS_SUFFIX);
+    if (!pm->name[0] && !pm->phys[0])
+        snprintf(pm->phys, sizeof(pm->phys), "%s", POINTER_PHYS_SUFFIX);
+
+    parse_debounce(cJSON_GetObjectItem(obj, "debounce"), &prof->debounce);
+    parse_socd(cJSON_GetObjectItem(obj, "socd"), prof);
+    parse_mappings(cJSON_GetObjectItem(obj, "mappings"), prof);
+    parse_pointer(pointer, &prof->pointer);
+}
+
+/* {"btw": "by the way", ...}: abbreviation typed -> text typed instead */
+static void parse_expansions(cJSON *obj, expand_t *ex) {
+    int n = cJSON_IsObject(obj) ? cJSON_GetArraySize(obj) : 0;
+    if (n == 0)
+        return;
+    const char **abbr = malloc((size_t)n * sizeof(*abbr));
+    const char **text = malloc((size_t)n * sizeof(*text));
+    int k = 0;
+    cJSON *item, *items = abbr && text ? obj : NULL;
+    cJSON_ArrayForEach(item, items) {
+        if (!cJSON_IsString(item)) {
+            fprintf(stderr, "Config: expansion of '%s' must be a string, skipping\n",
+                    item->string);
+            continue;
+        }
+        abbr[k] = item->string;
+        text[k++] = item->valuestring;
+    }
+    int kept = items ? expand_build(ex, abbr, text, k) : -1;
+    if (kept < 0)
+        fprintf(stderr, "Config: out of memory for the expansions\n");
+    else
+        fprintf(stderr, "Loaded %d expansions (%d trie nodes x %d characters)\n",
+                kept, ex->nodes, ex->nsym);
+    free(abbr);
+    free(text);
+}
+
+/* Original layout: one Naga V2 HyperSpeed on its USB dongle */
+static void default_profile(profile_t *prof) {
+    snprintf(prof->label, sizeof(prof->label), "default");
+    prof->match = (device_match_t){ RAZER_VENDOR, RAZER_PRODUCT, "", PHYS_SUFFIX };
+    prof->pointer_match = (device_match_t){ RAZER_VENDOR, RAZER_PRODUCT, "", POINTER_PHYS_SUFFIX };
+}
+
 static int parse_config(const char *path, config_t *cfg) {
     memset(cfg, 0, sizeof(*cfg));
 
@@ -87,373 +819,3598 @@ static int parse_config(const char *path, config_t *cfg) {
         return -1;
     }
 
+    cJSON *devices = cJSON_GetObjectItem(root, "devices");
     cJSON *mappings = cJSON_GetObjectItem(root, "mappings");
-    if (!cJSON_IsArray(mappings)) {
-        fprintf(stderr, "Config: 'mappings' must be an array\n");
+    if (cJSON_IsArray(devices)) {
+        cJSON *item;
+        cJSON_ArrayForEach(item, devices) {
+            if (cfg->num_profiles == MAX_PROFILES) {
+                fprintf(stderr, "Config: too many devices, using first %d\n", MAX_PROFILES);
+                break;
+            }
+            profile_t *prof = &cfg->profiles[cfg->num_profiles];
+            parse_profile(item, prof);
+            if (prof->match.vendor < 0 && !prof->match.name[0]) {
+                fprintf(stderr, "Config: device needs a vendor or name to match, skipping\n");
+                memset(prof, 0, sizeof(*prof));
+                continue;
+            }
+            if (!prof->label[0])
+                snprintf(prof->label, sizeof(prof->label), "device %d", cfg->num_profiles + 1);
+            cfg->num_profiles++;
+        }
+    } else if (cJSON_IsArray(mappings)) {
+        profile_t *prof = &cfg->profiles[cfg->num_profiles++];
+        default_profile(prof);
+        parse_passthrough(cJSON_GetObjectItem(root, "passthrough"), prof->passthrough);
+        parse_debounce(cJSON_GetObjectItem(root, "debounce"), &prof->debounce);
+        parse_socd(cJSON_GetObjectItem(root, "socd"), prof);
+        parse_mappings(mappings, prof);
+        parse_pointer(cJSON_GetObjectItem(root, "pointer"), &prof->pointer);
+    } else {
+        fprintf(stderr, "Config: need a 'devices' or 'mappings' array\n");
         cJSON_Delete(root);
         return -1;
     }
 
-    int n = cJSON_GetArraySize(mappings);
-    if (n > MAX_MAPPINGS) {
-        fprintf(stderr, "Config: too many mappings (%d), using first %d\n", n, MAX_MAPPINGS);
-        n = MAX_MAPPINGS;
+    parse_expansions(cJSON_GetObjectItem(root, "expansions"), &cfg->expand);
+    cJSON_Delete(root);
+    for (int i = 0; i < cfg->num_profiles; i++) {
+        profile_t *prof = &cfg->profiles[i];
+        fprintf(stderr, "Loaded %d mappings for %s%s from %s\n", prof->num_mappings,
+                prof->label, prof->keyboard ? " (keyboard)" : "",
+                path);
+        compile_mappings(prof);
+        compile_pointer(&prof->pointer);
+        print_debounce(&prof->debounce);
+        print_gestures(&prof->pointer.gesture);
     }
+    return 0;
+}
 
-    for (int i = 0; i < n; i++) {
-        cJSON *item = cJSON_GetArrayItem(mappings, i);
-        key_mapping_t *m = &cfg->mappings[cfg->num_mappings];
+/* Anything to do at all: a mapping, a forwarded pointer or an expansion */
+static int config_usable(const config_t *cfg) {
+    for (int i = 0; i < cfg->num_profiles; i++) {
+        if (cfg->profiles[i].num_mappings > 0 || cfg->profiles[i].pointer.enabled)
+            return 1;
+    }
+    return cfg->expand.count > 0;
+}
 
-        cJSON *btn = cJSON_GetObjectItem(item, "button");
-        if (!cJSON_IsString(btn)) continue;
+/* ── Device detection ──────────────────────────────────────────────── */
 
-        int code = key_name_to_code(btn->valuestring);
-        if (code < 0) {
-            fprintf(stderr, "Config: unknown key '%s', skipping\n", btn->valuestring);
-            continue;
-        }
-        m->button = code;
+/* What identifies an evdev node to the match rules */
+typedef struct {
+    char path[280];
+    struct input_id id;
+    char name[256];
+    char phys[256];
+} node_info_t;
 
-        cJSON *desc = cJSON_GetObjectItem(item, "description");
-        if (cJSON_IsString(desc))
-            snprintf(m->description, MAX_DESC_LEN, "%s", desc->valuestring);
-
-        cJSON *cmd = cJSON_GetObjectItem(item, "command");
-        cJSON *keys = cJSON_GetObjectItem(item, "keys");
-
-        if (cJSON_IsString(cmd)) {
-            snprintf(m->command, MAX_CMD_LEN, "%s", cmd->valuestring);
-        } else if (cJSON_IsArray(keys)) {
-            int nk = cJSON_GetArraySize(keys);
-            if (nk > MAX_KEYS) {
-                fprintf(stderr, "Config: too many keys in mapping '%s' (%d), using first %d\n",
-                        m->description, nk, MAX_KEYS);
-                nk = MAX_KEYS;
-            }
-            for (int k = 0; k < nk; k++) {
-                cJSON *key = cJSON_GetArrayItem(keys, k);
-                if (!cJSON_IsString(key)) continue;
-                int kc = key_name_to_code(key->valuestring);
-                if (kc < 0) {
-                    fprintf(stderr, "Config: unknown key '%s' in mapping '%s'\n",
-                            key->valuestring, m->description);
-                    continue;
-                }
-                m->keys[m->num_keys++] = kc;
-            }
-        } else {
-            fprintf(stderr, "Config: mapping '%s' has no 'keys' or 'command'\n",
-                    m->description);
-            continue;
-        }
+static int phys_has_suffix(const char *phys, const char *suffix) {
+    size_t plen = strlen(phys);
+    size_t slen = strlen(suffix);
+    return plen >= slen && strcmp(phys + plen - slen, suffix) == 0;
+}
+
+static int match_node(const device_match_t *m, const node_info_t *ni) {
+    return (m->vendor < 0 || m->vendor == ni->id.vendor) &&
+           (m->product < 0 || m->product == ni->id.product) &&
+           (!m->name[0] || strstr(ni->name, m->name)) &&
+           (!m->phys[0] || phys_has_suffix(ni->phys, m->phys));
+}
 
-        cfg->num_mappings++;
+/*
+ * The first profile claiming a node wins. Returns its index and sets
+ * *pointer for its pointer interface, or -1 if no profile wants the node.
+ */
+static int match_profile(const config_t *cfg, const node_info_t *ni, int *pointer) {
+    for (int i = 0; i < cfg->num_profiles; i++) {
+        const profile_t *prof = &cfg->profiles[i];
+        if (match_node(&prof->match, ni)) {
+            *pointer = 0;
+            return i;
+        }
+        if (prof->pointer.enabled && match_node(&prof->pointer_match, ni)) {
+            *pointer = 1;
+            return i;
+        }
     }
+    return -1;
+}
 
-    cJSON_Delete(root);
-    fprintf(stderr, "Loaded %d mappings from %s\n", cfg->num_mappings, path);
+/*
+ * Node identity comes from sysfs (/sys/class/input/eventN/device), so a
+ * scan reads a few small files per node instead of opening every event
+ * device, which would wake its driver. Only without sysfs (e.g. in some
+ * containers) are the nodes opened and asked with ioctls.
+ */
+#define SYSFS_INPUT "/sys/class/input"
+
+/* First line of a sysfs attribute, without the newline */
+static int sysfs_read(const char *dir, const char *attr, char *buf, size_t len) {
+    char path[320];
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    ssize_t n = read(fd, buf, len - 1);
+    close(fd);
+    if (n < 0)
+        return -1;
+    buf[n] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
     return 0;
 }
 
-/* ── Device detection ──────────────────────────────────────────────── */
+static int sysfs_hex(const char *dir, const char *attr, uint16_t *out) {
+    char buf[16];
+    if (sysfs_read(dir, attr, buf, sizeof(buf)) < 0)
+        return -1;
+    *out = (uint16_t)strtoul(buf, NULL, 16);
+    return 0;
+}
+
+static int node_from_sysfs(const char *event, node_info_t *ni) {
+    char dir[288];
+    snprintf(dir, sizeof(dir), SYSFS_INPUT "/%s/device", event);
+    memset(ni, 0, sizeof(*ni));
+    if (sysfs_hex(dir, "id/vendor", &ni->id.vendor) < 0 ||
+        sysfs_hex(dir, "id/product", &ni->id.product) < 0)
+        return -1;
+    sysfs_hex(dir, "id/bustype", &ni->id.bustype);
+    sysfs_hex(dir, "id/version", &ni->id.version);
+    sysfs_read(dir, "name", ni->name, sizeof(ni->name));
+    sysfs_read(dir, "phys", ni->phys, sizeof(ni->phys));
+    snprintf(ni->path, sizeof(ni->path), "/dev/input/%s", event);
+    return 0;
+}
+
+static int node_from_ioctl(const char *event, node_info_t *ni, int *perm_errors) {
+    memset(ni, 0, sizeof(*ni));
+    snprintf(ni->path, sizeof(ni->path), "/dev/input/%s", event);
+    int fd = open(ni->path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == EACCES) (*perm_errors)++;
+        return -1;
+    }
+    int rc = ioctl(fd, EVIOCGID, &ni->id);
+    if (rc == 0) {
+        ioctl(fd, EVIOCGNAME(sizeof(ni->name)), ni->name);
+        ioctl(fd, EVIOCGPHYS(sizeof(ni->phys)), ni->phys);
+    }
+    close(fd);
+    return rc;
+}
+
+/* Identify one node by its path, e.g. to check it is still the same device */
+static int node_probe(const char *path, node_info_t *ni) {
+    const char *event = strrchr(path, '/');
+    int perm_errors = 0;
+    event = event ? event + 1 : path;
+    if (strncmp(event, "event", 5) != 0)
+        return -1;
+    if (node_from_sysfs(event, ni) == 0)
+        return 0;
+    return node_from_ioctl(event, ni, &perm_errors);
+}
+
+/* Call fn for every event node we can identify, until it returns nonzero */
+static int scan_nodes(int (*fn)(const node_info_t *ni, void *arg), void *arg) {
+    int sysfs = 1;
+    DIR *dir = opendir(SYSFS_INPUT);
+    if (!dir) {
+        sysfs = 0;
+        dir = opendir("/dev/input");
+    }
+    if (!dir) {
+        perror("opendir /dev/input");
+        return -1;
+    }
+
+    int perm_errors = 0, ret = 0;
+    struct dirent *ent;
+    while (!ret && (ent = readdir(dir)) != NULL) {
+        if (strncmp(ent->d_name, "event", 5) != 0)
+            continue;
+        node_info_t ni;
+        if (sysfs ? node_from_sysfs(ent->d_name, &ni) == 0
+                  : node_from_ioctl(ent->d_name, &ni, &perm_errors) == 0)
+            ret = fn(&ni, arg);
+    }
+
+    closedir(dir);
+    if (perm_errors > 0)
+        fprintf(stderr, "Permission denied on %d device(s). "
+                "Are you running as root?\n", perm_errors);
+    return ret;
+}
+
+typedef struct {
+    const config_t *cfg;
+    const device_match_t *m;
+    node_info_t found;
+    int count;
+} scan_ctx_t;
+
+static int find_node_cb(const node_info_t *ni, void *arg) {
+    scan_ctx_t *ctx = arg;
+    if (!match_node(ctx->m, ni))
+        return 0;
+    ctx->found = *ni;
+    return 1;
+}
+
+/* Open the first node matching m */
+static int find_device(const device_match_t *m) {
+    scan_ctx_t ctx = {.m = m};
+    if (scan_nodes(find_node_cb, &ctx) <= 0)
+        return -1;
+    fprintf(stderr, "Found device: %s (%s) phys=%s\n",
+            ctx.found.name, ctx.found.path, ctx.found.phys);
+    return open(ctx.found.path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+static int detect_cb(const node_info_t *ni, void *arg) {
+    scan_ctx_t *ctx = arg;
+    int known = 0;
+    for (int i = 0; i < ctx->cfg->num_profiles; i++) {
+        const device_match_t *m = &ctx->cfg->profiles[i].match;
+        known |= (m->vendor < 0 || m->vendor == ni->id.vendor) &&
+                 (m->product < 0 || m->product == ni->id.product);
+    }
+    if (!known)
+        return 0;
+
+    int pointer = 0;
+    int prof = match_profile(ctx->cfg, ni, &pointer);
+    printf("  %s\n    Name: %s\n    ID:   %04x:%04x\n    Phys: %s\n    Profile: %s%s\n\n",
+           ni->path, ni->name, ni->id.vendor, ni->id.product, ni->phys,
+           prof < 0 ? "none" : ctx->cfg->profiles[prof].label,
+           prof < 0 ? "" : pointer ? " (pointer)" :
+           ctx->cfg->profiles[prof].keyboard ? " (keyboard)" : " (side buttons)");
+    ctx->count++;
+    return 0;
+}
+
+static void detect_devices(const config_t *cfg) {
+    printf("Scanning for configured devices...\n\n");
+    scan_ctx_t ctx = {.cfg = cfg};
+    scan_nodes(detect_cb, &ctx);
+    if (!ctx.count)
+        printf("No matching devices found. Is the mouse connected?\n");
+}
+
+/* ── uinput virtual device ─────────────────────────────────────────── */
+
+/* Register the capabilities set on fd under name and create the device */
+static int uinput_create(int fd, const char *name, int product) {
+    struct uinput_setup setup = {0};
+    snprintf(setup.name, UINPUT_MAX_NAME_SIZE, "%s", name);
+    setup.id.bustype = BUS_VIRTUAL;
+    setup.id.vendor  = 0x1234;
+    setup.id.product = product;
+    setup.id.version = 1;
+
+    if (ioctl(fd, UI_DEV_SETUP, &setup) < 0) {
+        perror("UI_DEV_SETUP");
+        close(fd);
+        return -1;
+    }
+
+    if (ioctl(fd, UI_DEV_CREATE) < 0) {
+        perror("UI_DEV_CREATE");
+        close(fd);
+        return -1;
+    }
+
+    /* Give udev time to create the device node */
+    usleep(100000);
+
+    fprintf(stderr, "Virtual input device created: %s\n", name);
+    return fd;
+}
+
+static int setup_uinput(void) {
+    int fd = open("/dev/uinput", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("open /dev/uinput");
+        return -1;
+    }
+
+    if (ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0 ||
+        ioctl(fd, UI_SET_EVBIT, EV_SYN) < 0 ||
+        ioctl(fd, UI_SET_EVBIT, EV_REP) < 0) {
+        perror("UI_SET_EVBIT");
+        close(fd);
+        return -1;
+    }
+
+    /* Register every keyboard key, so X11/libinput recognizes this as a
+       proper keyboard device and a grabbed keyboard's keys can all be
+       passed on. Mouse, joystick and gamepad buttons stay off: libinput
+       would take a keyboard advertising them for a mouse. */
+    for (int code = KEY_ESC; code < KEY_CNT; code++) {
+        if ((code >= BTN_MISC && code < KEY_OK) ||
+            (code >= BTN_DPAD_UP && code <= BTN_DPAD_RIGHT) ||
+            code >= BTN_TRIGGER_HAPPY)
+            continue;
+        ioctl(fd, UI_SET_KEYBIT, code);
+    }
+
+    return uinput_create(fd, "naga-remap virtual keyboard", 0x5678);
+}
+
+/* Second device carrying the main pointer interface: motion, wheels, buttons */
+static int setup_uinput_pointer(void) {
+    static const int rel[] = {
+        REL_X, REL_Y, REL_WHEEL, REL_HWHEEL, REL_WHEEL_HI_RES, REL_HWHEEL_HI_RES
+    };
+
+    int fd = open("/dev/uinput", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("open /dev/uinput");
+        return -1;
+    }
+
+    if (ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0 ||
+        ioctl(fd, UI_SET_EVBIT, EV_REL) < 0 ||
+        ioctl(fd, UI_SET_EVBIT, EV_SYN) < 0) {
+        perror("UI_SET_EVBIT");
+        close(fd);
+        return -1;
+    }
+    for (int code = BTN_LEFT; code <= BTN_TASK; code++)
+        ioctl(fd, UI_SET_KEYBIT, code);
+    for (size_t i = 0; i < sizeof(rel) / sizeof(rel[0]); i++)
+        ioctl(fd, UI_SET_RELBIT, rel[i]);
+    ioctl(fd, UI_SET_PROPBIT, INPUT_PROP_POINTER);
+
+    return uinput_create(fd, "naga-remap virtual pointer", 0x5679);
+}
+
+/* ── Latency accounting ────────────────────────────────────────────── */
+
+/*
+ * evdev timestamps are switched to CLOCK_MONOTONIC, so for every handled
+ * event we can measure the time from the kernel stamping it to the uinput
+ * write carrying its result returning (or, for commands, fork() returning).
+ * Samples are queued with the output and recorded when it is flushed.
+ */
+enum { LAT_COMBO, LAT_COMMAND, LAT_FORWARD, LAT_MOTION, LAT_NTYPES };
+static const char *const lat_type_names[LAT_NTYPES] = {
+    "combo", "command", "forward", "motion"
+};
+
+typedef struct {
+    uint64_t t_ns;              /* kernel timestamp of the source event */
+    int16_t map;                /* profile * MAX_MAPPINGS + mapping, -1 for none */
+    uint8_t type;
+} lat_sample_t;
+
+static hist_t g_lat_type[LAT_NTYPES];
+static hist_t g_lat_map[MAX_PROFILES * MAX_MAPPINGS];
+static hist_t g_lat_ptr_batch;          /* pointer batch, read() return to write() return */
+static uint64_t g_ev_time_ns;           /* event being handled; 0 = no usable timestamp */
+static lat_sample_t g_lat_pending[OUT_MAX];
+static int g_lat_npending;
+
+/*
+ * With --busy-poll the loop spins while input keeps coming instead of
+ * going to sleep, and samples are also split by how their event was
+ * picked up, so the gain can be weighed against the CPU it burns.
+ */
+static long g_busy_poll_ms = -1;        /* idle time before blocking again, 0 = never; -1 off */
+static int g_busy_poll_cpu = -1;
+static int g_wake_spin;                 /* batch being handled was picked up spinning */
+static hist_t g_lat_wake[2];            /* after blocking, while spinning */
+static struct {
+    uint64_t start_ns, spin_ns;
+    unsigned long polls, fallbacks;     /* empty polls, idle periods that ended in blocking */
+} g_spin;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void lat_commit(const lat_sample_t *s, int n) {
+    if (n == 0)
+        return;
+    uint64_t now = now_ns();
+    for (int i = 0; i < n; i++) {
+        uint64_t d = now > s[i].t_ns ? now - s[i].t_ns : 0;
+        hist_add(&g_lat_type[s[i].type], d);
+        if (s[i].map >= 0)
+            hist_add(&g_lat_map[s[i].map], d);
+        if (g_busy_poll_ms >= 0)
+            hist_add(&g_lat_wake[g_wake_spin], d);
+    }
+}
+
+static void lat_note(int map, int type) {
+    if (!g_ev_time_ns)
+        return;
+    lat_sample_t s = { g_ev_time_ns, (int16_t)map, (uint8_t)type };
+    if (type == LAT_COMMAND)
+        lat_commit(&s, 1);
+    else if (g_lat_npending < OUT_MAX)
+        g_lat_pending[g_lat_npending++] = s;
+}
+
+static void lat_print(const char *label, const hist_t *h) {
+    if (h->count == 0)
+        return;
+    fprintf(stderr, "  %-24s n=%-8lu p50=%.1f p90=%.1f p99=%.1f max=%.1f\n", label,
+            (unsigned long)h->count,
+            hist_percentile(h, 0.50) / 1e3, hist_percentile(h, 0.90) / 1e3,
+            hist_percentile(h, 0.99) / 1e3, h->max / 1e3);
+}
+
+static void lat_dump(const config_t *cfg) {
+    uint64_t total = 0;
+    for (int t = 0; t < LAT_NTYPES; t++)
+        total += g_lat_type[t].count;
+    if (g_lat_ptr_batch.count)
+        fprintf(stderr, "Pointer batch, read to uinput write (us):\n");
+    lat_print("pointer batch", &g_lat_ptr_batch);
+    if (total == 0)
+        return;
+
+    fprintf(stderr, "Latency, event timestamp to uinput write (us):\n");
+    for (int t = 0; t < LAT_NTYPES; t++)
+        lat_print(lat_type_names[t], &g_lat_type[t]);
+    for (int p = 0; p < cfg->num_profiles; p++) {
+        const profile_t *prof = &cfg->profiles[p];
+        for (int i = 0; i < prof->num_mappings; i++) {
+            char label[160];
+            snprintf(label, sizeof(label), "%s%s%s %s",
+                     cfg->num_profiles > 1 ? prof->label : "",
+                     cfg->num_profiles > 1 ? ": " : "",
+                     key_code_to_name(prof->mappings[i].button), prof->mappings[i].description);
+            lat_print(label, &g_lat_map[p * MAX_MAPPINGS + i]);
+        }
+    }
+}
+
+/* ── I/O backends ──────────────────────────────────────────────────── */
+
+/*
+ * Two interchangeable backends move events in and out of the daemon:
+ * plain read()/write() on the evdev and uinput fds, or an io_uring with a
+ * multishot read kept armed on the evdev fd and uinput writes submitted as
+ * linked SQEs. The counters below let the two be compared on a given kernel.
+ */
+static struct {
+    unsigned long waits;        /* epoll_wait() calls */
+    unsigned long reads;        /* read() calls on evdev */
+    unsigned long writes;       /* write() calls on uinput */
+    unsigned long enters;       /* io_uring_enter() calls */
+    unsigned long events_in;
+    unsigned long events_out;
+    unsigned long wakeups;      /* input became ready and we read it */
+    unsigned long bytes_in;
+    unsigned long discarded;    /* non-key and unmapped events dropped in userspace */
+    unsigned long ptr_frames;   /* frames written to the virtual pointer */
+} g_io;
+
+#define URING_ENTRIES  64
+#define URING_SLOTS    8      /* output batches that may be in flight */
+#define URING_NBUF     8      /* provided buffers for the multishot read */
+
+enum { UD_READ = 1, UD_WRITE, UD_PBUF, UD_CANCEL };
+#define UD(tag, arg)   (((uint64_t)(arg) << 8) | (tag))
+#define UD_LAST        0x80   /* write slot flag: last SQE of a chain */
+
+static int g_use_uring = 0;
+static uring_t g_ring = { .fd = -1 };
+static int g_uring_multishot = 1;
+static struct input_event g_uring_in[URING_NBUF][EV_BATCH];
+static struct input_event g_uring_out[URING_SLOTS][OUT_MAX];
+static int g_uring_out_busy[URING_SLOTS];
+/* latency samples riding on each slot, recorded when its chain completes */
+static lat_sample_t g_uring_lat[URING_SLOTS][OUT_MAX];
+static int g_uring_nlat[URING_SLOTS];
+
+static void uring_provide(int bid) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&g_ring);
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = 1;
+    sqe->addr = (uintptr_t)g_uring_in[bid];
+    sqe->len = sizeof(g_uring_in[bid]);
+    sqe->off = bid;
+    sqe->buf_group = 0;
+    sqe->user_data = UD(UD_PBUF, bid);
+}
+
+/* key identifies the device (slot | generation << 8) in the completion */
+static void uring_arm_read(int fd, unsigned key) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&g_ring);
+    if (!sqe)
+        return;
+    sqe->fd = fd;
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = UD(UD_READ, key);
+    if (g_uring_multishot) {
+        sqe->opcode = IORING_OP_READ_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+    } else {
+        sqe->opcode = IORING_OP_READ;
+        sqe->addr = (uintptr_t)g_uring_in[(key & 0xff) % URING_NBUF];
+        sqe->len = sizeof(g_uring_in[0]);
+    }
+}
+
+static void uring_cancel_read(unsigned key) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&g_ring);
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = UD(UD_READ, key);
+    sqe->user_data = UD(UD_CANCEL, 0);
+}
+
+static void uring_flush(void) {
+    if (uring_pending(&g_ring) == 0)
+        return;
+    g_io.enters++;
+    if (uring_submit(&g_ring, 0) < 0)
+        perror("io_uring_enter");
+}
+
+/*
+ * Queue one write SQE per SYN frame, linked so the kernel applies them in
+ * order. Only the tail of the chain posts a completion on success, which
+ * frees the slot. Returns -1 if no slot or SQEs are free.
+ */
+static int uring_write(int fd, const struct input_event *evs, int n) {
+    if (n <= 0 || n > OUT_MAX)
+        return -1;
+    int slot = -1;
+    for (int i = 0; i < URING_SLOTS; i++) {
+        if (!g_uring_out_busy[i]) { slot = i; break; }
+    }
+    if (slot < 0)
+        return -1;
+
+    unsigned frames = 0;
+    for (int i = 0; i < n; i++) {
+        if (i == n - 1 || (evs[i].type == EV_SYN && evs[i].code == SYN_REPORT))
+            frames++;
+    }
+    if (uring_sq_space(&g_ring) < frames)
+        return -1;
+
+    struct input_event *out = g_uring_out[slot];
+    memcpy(out, evs, (size_t)n * sizeof(*evs));
+    int skip = (g_ring.features & IORING_FEAT_CQE_SKIP) != 0;
+
+    int start = 0;
+    for (int i = 0; i < n; i++) {
+        int last = (i == n - 1);
+        if (!last && !(evs[i].type == EV_SYN && evs[i].code == SYN_REPORT))
+            continue;
+        struct io_uring_sqe *sqe = uring_get_sqe(&g_ring);
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = fd;
+        sqe->addr = (uintptr_t)&out[start];
+        sqe->len = (i + 1 - start) * sizeof(*out);
+        sqe->off = (uint64_t)-1;
+        if (!last)
+            sqe->flags = IOSQE_IO_LINK | (skip ? IOSQE_CQE_SKIP_SUCCESS : 0);
+        sqe->user_data = UD(UD_WRITE, slot | (last ? UD_LAST : 0));
+        start = i + 1;
+    }
+    g_uring_out_busy[slot] = 1;
+    memcpy(g_uring_lat[slot], g_lat_pending, g_lat_npending * sizeof(g_lat_pending[0]));
+    g_uring_nlat[slot] = g_lat_npending;
+    g_lat_npending = 0;
+    uring_flush();
+    return 0;
+}
+
+/* ── Output queue ──────────────────────────────────────────────────── */
+
+/*
+ * Events for the virtual device are queued and flushed once per handled
+ * input batch: a single write() on the plain backend, a chain of linked
+ * SQEs on the io_uring backend.
+ */
+static struct input_event g_out[OUT_MAX];
+static int g_out_len;
+
+static inline int test_bit(const unsigned char *bits, int bit) {
+    return (bits[bit / 8] >> (bit % 8)) & 1;
+}
+
+static inline void assign_bit(unsigned char *bits, int bit, int on) {
+    if (on) bits[bit / 8] |=  (unsigned char)(1 << (bit % 8));
+    else    bits[bit / 8] &= (unsigned char)~(1 << (bit % 8));
+}
+
+/*
+ * Keys held down on the virtual keyboard, as the kernel sees them, and
+ * when each went down. Whatever is still held when the daemon exits, or
+ * when no source button is held any more, is released latest-first, so
+ * modifiers come up last as they would from the combo. Noting a key is a
+ * bit flip and a store; ordering is only worked out on release.
+ */
+static unsigned char g_held[KEY_CNT / 8 + 1];
+static uint32_t g_held_seq[KEY_CNT];
+static uint32_t g_held_next;
+
+static inline void held_note(int code, int down) {
+    if ((unsigned)code >= KEY_CNT || test_bit(g_held, code) == down)
+        return;
+    assign_bit(g_held, code, down);
+    if (down)
+        g_held_seq[code] = ++g_held_next;
+}
+
+static void out_flush(int fd) {
+    if (g_out_len == 0)
+        return;
+    g_io.events_out += g_out_len;
+    if (!g_use_uring || uring_write(fd, g_out, g_out_len) < 0) {
+        g_io.writes++;
+        if (write(fd, g_out, g_out_len * sizeof(g_out[0])) < 0)
+            perror("write uinput");
+        lat_commit(g_lat_pending, g_lat_npending);
+    }
+    g_out_len = 0;
+    g_lat_npending = 0;
+}
+
+static void emit_event(int fd, int type, int code, int value) {
+    if (g_out_len == OUT_MAX)
+        out_flush(fd);
+    struct input_event *ev = &g_out[g_out_len++];
+    memset(ev, 0, sizeof(*ev));
+    ev->type = type;
+    ev->code = code;
+    ev->value = value;
+    if (type == EV_KEY && value != 2)
+        held_note(code, value);
+}
+
+static void emit_syn(int fd) {
+    emit_event(fd, EV_SYN, SYN_REPORT, 0);
+}
+
+static void held_release_all(int fd) {
+    uint16_t codes[KEY_CNT];
+    int n = 0;
+    for (int code = 0; code < KEY_CNT; code++)
+        if (test_bit(g_held, code))
+            codes[n++] = (uint16_t)code;
+    /* Latest press first; rarely more than a handful, so insertion sort */
+    for (int i = 1; i < n; i++) {
+        uint16_t c = codes[i];
+        int j = i;
+        for (; j > 0 && g_held_seq[codes[j - 1]] < g_held_seq[c]; j--)
+            codes[j] = codes[j - 1];
+        codes[j] = c;
+    }
+    for (int i = 0; i < n; i++) {
+        emit_event(fd, EV_KEY, codes[i], 0);
+        emit_syn(fd);
+    }
+    out_flush(fd);
+    if (n && g_debug)
+        fprintf(stderr, "[release] %d key(s) left held on the virtual keyboard\n", n);
+}
+
+/*
+ * Modifier keys held on the real keyboards, one bit per key (left ctrl,
+ * shift, alt, meta, then the right ones), and folded into MOD_* for
+ * picking mappings. Both stay 0 unless some mapping needs modifiers or a
+ * keyboard is grabbed; see the keyboard monitor. A combo doesn't press a
+ * modifier the user is already holding, so letting go of the combo can't
+ * release it under the user's finger.
+ */
+static const uint16_t g_modkeys[8] = {
+    KEY_LEFTCTRL, KEY_LEFTSHIFT, KEY_LEFTALT, KEY_LEFTMETA,
+    KEY_RIGHTCTRL, KEY_RIGHTSHIFT, KEY_RIGHTALT, KEY_RIGHTMETA
+};
+static uint8_t g_kbd_held;
+static unsigned g_mods;
+/* Per profile and button, like g_btn_map: the combo modifiers its press
+   left to the keyboard, which its release must not let go of either */
+static uint8_t g_mod_skipped[MAX_PROFILES][KEY_CNT];
+
+static uint8_t modkey_bit(int code) {
+    for (int i = 0; i < 8; i++) {
+        if (g_modkeys[i] == code)
+            return (uint8_t)(1 << i);
+    }
+    return 0;
+}
+
+/* ── Key combo emission ────────────────────────────────────────────── */
+
+static void emit_key_down(int uinput_fd, const key_mapping_t *m, uint8_t *skipped) {
+    /* Press each key with its own SYN, like a real keyboard */
+    *skipped = 0;
+    for (int i = 0; i < m->num_keys; i++) {
+        uint8_t bit = g_kbd_held ? modkey_bit(m->keys[i]) : 0;
+        if (bit & g_kbd_held) {
+            *skipped |= bit;
+            continue;
+        }
+        emit_event(uinput_fd, EV_KEY, m->keys[i], 1);
+        emit_syn(uinput_fd);
+    }
+}
+
+static void emit_key_up(int uinput_fd, const key_mapping_t *m, uint8_t *skipped) {
+    /* Release in reverse order, each with its own SYN */
+    for (int i = m->num_keys - 1; i >= 0; i--) {
+        uint8_t bit = *skipped ? modkey_bit(m->keys[i]) : 0;
+        if (bit & *skipped) {
+            *skipped &= (uint8_t)~bit;
+            continue;
+        }
+        emit_event(uinput_fd, EV_KEY, m->keys[i], 0);
+        emit_syn(uinput_fd);
+    }
+}
+
+static void emit_key_repeat(int uinput_fd, const key_mapping_t *m) {
+    /* Repeat only the last key (the non-modifier) */
+    if (m->num_keys > 0) {
+        emit_event(uinput_fd, EV_KEY, m->keys[m->num_keys - 1], 2);
+        emit_syn(uinput_fd);
+    }
+}
+
+/* ── SOCD resolution ───────────────────────────────────────────────── */
+
+/*
+ * Opposing mappings, like strafe left and right on two side buttons,
+ * resolve by last input priority. Pressing one while another of its
+ * group is held releases the older combo on the virtual keyboard. Letting
+ * go of the newer one presses the latest still-held one again. The state
+ * is a held mask and press order per group, a few bytes each, and
+ * updating it is a handful of compares on top of the plain combo path.
+ */
+typedef struct {
+    uint8_t held;                   /* slots physically held */
+    uint8_t order[MAX_SOCD_KEYS];   /* held slots, oldest first */
+    uint8_t n;
+    uint8_t active;                 /* slot + 1 down on the virtual keyboard, 0 = none */
+} socd_state_t;
+
+static socd_state_t g_socd[MAX_PROFILES][MAX_SOCD_GROUPS];
+
+static const key_mapping_t *socd_mapping(const profile_t *prof, const socd_group_t *grp,
+                                         int slot) {
+    return &prof->mappings[prof->lookup[grp->buttons[slot]] - 1];
+}
+
+static void socd_key(int uinput_fd, const profile_t *prof, socd_state_t *st,
+                     uint8_t *skipped, const key_mapping_t *m, int value) {
+    const socd_group_t *grp = &prof->socd[m->socd - 1];
+    int slot = m->socd_slot;
+    uint8_t bit = (uint8_t)(1 << slot);
+
+    if (value == 2) {
+        if (st->active == slot + 1)
+            emit_key_repeat(uinput_fd, m);
+        return;
+    }
+    if (value == 1) {
+        if (st->held & bit)
+            return;
+        st->held |= bit;
+        st->order[st->n++] = (uint8_t)slot;
+        if (st->active) {
+            const key_mapping_t *old = socd_mapping(prof, grp, st->active - 1);
+            emit_key_up(uinput_fd, old, &skipped[old->button]);
+        }
+        emit_key_down(uinput_fd, m, &skipped[m->button]);
+        st->active = (uint8_t)(slot + 1);
+        return;
+    }
+
+    if (!(st->held & bit))
+        return;
+    st->held &= (uint8_t)~bit;
+    int i = 0;
+    while (st->order[i] != slot)
+        i++;
+    for (st->n--; i < st->n; i++)
+        st->order[i] = st->order[i + 1];
+    if (st->active != slot + 1)
+        return;
+    emit_key_up(uinput_fd, m, &skipped[m->button]);
+    st->active = 0;
+    if (st->n) {
+        int top = st->order[st->n - 1];
+        const key_mapping_t *next = socd_mapping(prof, grp, top);
+        emit_key_down(uinput_fd, next, &skipped[next->button]);
+        st->active = (uint8_t)(top + 1);
+    }
+}
+
+/* ── Command execution ─────────────────────────────────────────────── */
+
+static void exec_command(const char *cmd) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return;
+    }
+    if (pid == 0) {
+        /* Child: detach and redirect to /dev/null */
+        sigprocmask(SIG_SETMASK, &g_orig_sigmask, NULL);
+        setsid();
+        int devnull = open("/dev/null", O_RDWR);
+        if (devnull >= 0) {
+            dup2(devnull, STDIN_FILENO);
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+            if (devnull > 2) close(devnull);
+        }
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+    /* Parent: fire-and-forget (SA_NOCLDWAIT handles reaping) */
+}
+
+/* ── Gestures ──────────────────────────────────────────────────────── */
+
+/*
+ * While a profile's gesture button is held, the raw motion of its pointer
+ * is sampled every `step` counts (|dx| + |dy|) and each sample quantized
+ * to one of eight directions. A run of samples one way becomes a segment
+ * of the stroke once it covers min_distance; shorter runs, the wobble of
+ * a turn, are dropped. A motion frame costs an add and a compare, a
+ * sample a few more, and the stroke keeps at most MAX_STROKE directions,
+ * whatever the polling rate. Motion is forwarded as usual all along; the
+ * stroke is matched, and its action fired, on release.
+ */
+typedef struct {
+    int prof;                   /* profile whose button is held, -1: none */
+    int32_t ax, ay;             /* motion since the last sample */
+    int run_dir;                /* direction of the current run, -1: none */
+    int32_t run_len;            /* counts it covers so far */
+    int run_seg;                /* already made a segment */
+    unsigned char dirs[MAX_STROKE];
+    int num_dirs;
+    int overflow;               /* longer than any gesture can be */
+} gesture_state_t;
+
+static gesture_state_t g_gesture = { .prof = -1 };
+
+/* Within 22.5 degrees of an axis (tan ~ 2/5) it's that axis, else a diagonal */
+static int gesture_dir(int32_t x, int32_t y) {
+    int64_t ax = x < 0 ? -(int64_t)x : x, ay = y < 0 ? -(int64_t)y : y;
+    if (ay * 5 < ax * 2)
+        return x > 0 ? DIR_RIGHT : DIR_LEFT;
+    if (ax * 5 < ay * 2)
+        return y > 0 ? DIR_DOWN : DIR_UP;
+    if (x > 0)
+        return y > 0 ? DIR_DOWN_RIGHT : DIR_UP_RIGHT;
+    return y > 0 ? DIR_DOWN_LEFT : DIR_UP_LEFT;
+}
+
+static void gesture_feed(const gesture_cfg_t *gc, int32_t dx, int32_t dy) {
+    gesture_state_t *st = &g_gesture;
+    st->ax += dx;
+    st->ay += dy;
+    int32_t len = (int32_t)(accel_abs(st->ax) + accel_abs(st->ay));
+    if (len < gc->step)
+        return;
+
+    int dir = gesture_dir(st->ax, st->ay);
+    st->ax = st->ay = 0;
+    if (dir != st->run_dir) {
+        st->run_dir = dir;
+        st->run_len = 0;
+        st->run_seg = 0;
+    }
+    if (st->run_seg)
+        return;
+    st->run_len += len;
+    if (st->run_len < gc->min_distance)
+        return;
+    st->run_seg = 1;
+    /* The same way again after a wobble continues the segment */
+    if (st->num_dirs && st->dirs[st->num_dirs - 1] == dir)
+        return;
+    if (st->num_dirs == MAX_STROKE) {
+        st->overflow = 1;
+        return;
+    }
+    st->dirs[st->num_dirs++] = (unsigned char)dir;
+}
+
+static void gesture_fire(int uinput_fd, const gesture_cfg_t *gc) {
+    const gesture_state_t *st = &g_gesture;
+    const gesture_t *g = NULL;
+    for (int i = 0; i < gc->num_gestures && !st->overflow && !g; i++) {
+        if (gc->gestures[i].num_dirs == st->num_dirs &&
+            memcmp(gc->gestures[i].dirs, st->dirs, (size_t)st->num_dirs) == 0)
+            g = &gc->gestures[i];
+    }
+    if (g_debug) {
+        fprintf(stderr, "[gesture]");
+        for (int k = 0; k < st->num_dirs; k++)
+            fprintf(stderr, " %s", dir_names[st->dirs[k]]);
+        fprintf(stderr, "%s -> %s\n", st->overflow ? " ..." : st->num_dirs ? "" : " tap",
+                !g ? "no match" : g->action.command[0] ? g->action.command
+                                                       : g->action.description);
+    }
+    if (!g)
+        return;
+    if (g->action.command[0] != '\0') {
+        exec_command(g->action.command);
+    } else {
+        uint8_t skipped;
+        emit_key_down(uinput_fd, &g->action, &skipped);
+        emit_key_up(uinput_fd, &g->action, &skipped);
+    }
+}
+
+static void gesture_button(int uinput_fd, int prof, const gesture_cfg_t *gc, int value) {
+    if (value == 1 && g_gesture.prof < 0) {
+        memset(&g_gesture, 0, sizeof(g_gesture));
+        g_gesture.prof = prof;
+        g_gesture.run_dir = -1;
+    } else if (value == 0 && g_gesture.prof == prof) {
+        g_gesture.prof = -1;
+        gesture_fire(uinput_fd, gc);
+    }
+}
+
+/* ── Text expansion ────────────────────────────────────────────────── */
+
+/*
+ * Keys typed on the keyboards walk the abbreviation trie (expand.h) one
+ * character each. When an abbreviation completes, it is taken back with
+ * backspaces and its expansion typed on the virtual keyboard. Keys come
+ * from the keyboard monitor, which only reads, or from a grabbed
+ * keyboard's passthrough; what we type ourselves never comes back. A
+ * shortcut or a key that moves the cursor starts over. If a modifier is
+ * down when the abbreviation completes, typing waits for it to come up,
+ * so the expansion isn't typed shifted.
+ */
+#define SHIFT_HELD  0x22        /* left and right shift in g_kbd_held */
+
+static expand_state_t g_expand = { .stack = { EXPAND_ROOT } };
+static uint32_t g_expand_hit;   /* completed under a modifier, + 1 */
+
+/* A key of a keyboard; returns the expansion it completes, + 1, or 0 */
+static uint32_t expand_key(const expand_t *ex, int code, int value) {
+    if (value == 0 || modkey_bit(code) || code == KEY_CAPSLOCK)
+        return 0;
+    g_expand_hit = 0;
+    if (code == KEY_BACKSPACE) {
+        expand_back(&g_expand);
+        return 0;
+    }
+    int ch = g_kbd_held & ~SHIFT_HELD ? 0 : expand_char(code, g_kbd_held & SHIFT_HELD);
+    if (!ch) {
+        expand_reset(&g_expand, EXPAND_ROOT);
+        return 0;
+    }
+    uint32_t hit = expand_step(ex, &g_expand, ch);
+    if (hit && g_kbd_held) {
+        g_expand_hit = hit;
+        return 0;
+    }
+    return hit;
+}
+
+static void expand_tap(int fd, int code) {
+    emit_event(fd, EV_KEY, code, 1);
+    emit_syn(fd);
+    emit_event(fd, EV_KEY, code, 0);
+    emit_syn(fd);
+}
+
+static void expand_type(int fd, const expand_t *ex, uint32_t hit) {
+    const char *text = ex->pool + ex->text[hit - 1];
+    if (g_debug)
+        fprintf(stderr, "[expand] %d characters -> \"%s\"\n", ex->len[hit - 1], text);
+    for (int i = 0; i < ex->len[hit - 1]; i++)
+        expand_tap(fd, KEY_BACKSPACE);
+    for (const char *p = text; *p; p++) {
+        int shift, code = expand_key_of(*p, &shift);
+        if (!code)
+            continue;
+        if (shift) {
+            emit_event(fd, EV_KEY, KEY_LEFTSHIFT, 1);
+            emit_syn(fd);
+        }
+        expand_tap(fd, code);
+        if (shift) {
+            emit_event(fd, EV_KEY, KEY_LEFTSHIFT, 0);
+            emit_syn(fd);
+        }
+    }
+    expand_reset(&g_expand, EXPAND_ROOT);
+}
+
+/* Type what waited for the modifiers, once they are all up */
+static void expand_pending(int fd, const expand_t *ex) {
+    if (g_expand_hit && !g_kbd_held) {
+        expand_type(fd, ex, g_expand_hit);
+        g_expand_hit = 0;
+    }
+}
+
+/* ── Input devices ─────────────────────────────────────────────────── */
+
+/*
+ * The mapping engine consumes batches of struct input_event from an input
+ * source. Besides the grabbed evdev node, events can come from a recorded
+ * trace file (raw input_event records, e.g. `cat /dev/input/eventN`) or a
+ * pipe/socketpair, or be generated (synth:), which lets the engine run at
+ * full speed on synthetic data without root or a real device.
+ *
+ * Every evdev node claimed by a profile, and every source named on the
+ * command line, occupies one slot of g_devs and carries its own frame,
+ * keymap and pointer state; held buttons are tracked per profile, so a
+ * sniper button on the side-button interface can act on the pointer.
+ */
+typedef struct input_dev input_dev_t;
+
+typedef struct {
+    const char *name;
+    int  (*open)(input_dev_t *dev);         /* returns the fd, or -1 */
+    /* events read into buf; 0 at end of input; -1 with errno set */
+    int  (*next)(input_dev_t *dev, struct input_event *buf, int max);
+    void (*close)(input_dev_t *dev);
+    /* current key state bitmap; NULL or -1 if the source can't tell */
+    int  (*resync)(input_dev_t *dev, unsigned char *keys, size_t len);
+    int pollable;               /* fd can wait in epoll */
+    int reconnect;              /* re-open after the source goes away */
+} input_ops_t;
+
+#define MAX_INPUTS  8
+#define KEYMAP_MAX  512
+#define PTR_OUT_MAX (EV_BATCH * 2)
+#define DEBOUNCE_WAIT 16        /* buttons per device waiting out a window */
+
+struct input_dev {
+    source_t src;
+    const input_ops_t *ops;     /* NULL: free slot */
+    const char *arg;            /* trace path, pipe fd/path or synth rate */
+    node_info_t node;           /* evdev: the node and what it matched on */
+    int prof;                   /* index into g_cfg.profiles */
+    int fixed;                  /* named on the command line, never freed */
+    unsigned uring_gen;         /* bumped per attach; stale reads are ignored */
+    /* Tail of a record split across reads (pipes) */
+    unsigned char part[sizeof(struct input_event)];
+    size_t part_len;
+    /* Events of the frame in progress, handled once its SYN_REPORT arrives */
+    struct input_event frame[EV_BATCH];
+    int frame_len;
+    int dropped;                /* discarding until SYN_REPORT after SYN_DROPPED */
+    int passive;                /* fully offloaded: not grabbed, only watched for hangup */
+    int mono_clock;             /* event timestamps are CLOCK_MONOTONIC */
+    int pointer;                /* main pointer interface: forward what isn't mapped */
+    unsigned char keybits[KEY_CNT / 8 + 1];     /* keys the source can report */
+    /* Keymap offload: entries we overwrote, and keys the device now
+       translates itself and we forward as-is */
+    struct { uint32_t index; uint16_t keycode; } keymap_saved[KEYMAP_MAX];
+    int keymap_saved_n;
+    unsigned char keymap_fwd[KEY_CNT / 8 + 1];
+    /* Pointer passthrough queue, see process_pointer() */
+    struct input_event pout[PTR_OUT_MAX];
+    int pout_len;               /* events queued */
+    int pout_frame;             /* start of the frame still being assembled */
+    lat_sample_t pout_lat[PTR_OUT_MAX / 2];
+    int pout_nlat;
+    int32_t motion_dx, motion_dy;   /* motion of the frame in progress */
+    int motion;
+    accel_state_t accel;
+    int32_t wheel_lo, wheel_hi;     /* REL_WHEEL, REL_WHEEL_HI_RES of the frame */
+    int wheel;                      /* bit 0: lo seen, bit 1: hi-res seen */
+    /* Debounce, see debounce(): time of the last accepted edge, the state
+       handed on, and buttons whose other state is waiting for a deadline */
+    uint64_t db_t[KEY_CNT];
+    unsigned char db_state[KEY_CNT / 8 + 1];
+    unsigned char db_pending[KEY_CNT / 8 + 1];
+    struct { uint16_t code; uint64_t due; } db_wait[DEBOUNCE_WAIT];
+    int db_nwait;
+    /* synth: generated motion frames */
+    uint64_t synth_period_ns;
+    unsigned long synth_seq, synth_frames;
+};
+
+static config_t g_cfg;
+static char g_config_path[512];
+static input_dev_t g_devs[MAX_INPUTS];
+/* Source buttons currently held, per profile, as last seen by us */
+static unsigned char g_btn_state[MAX_PROFILES][KEY_CNT / 8 + 1];
+/* Modifier keys held on each grabbed keyboard, as in g_kbd_held */
+static uint8_t g_dev_mods[MAX_INPUTS];
+
+static void kbd_update(void);
+
+static inline const profile_t *dev_profile(const input_dev_t *dev) {
+    return &g_cfg.profiles[dev->prof];
+}
+
+static input_dev_t *dev_alloc(void) {
+    for (int i = 0; i < MAX_INPUTS; i++) {
+        input_dev_t *dev = &g_devs[i];
+        if (dev->ops)
+            continue;
+        unsigned gen = dev->uring_gen;
+        memset(dev, 0, sizeof(*dev));
+        dev->src.fd = -1;
+        dev->uring_gen = gen;
+        return dev;
+    }
+    return NULL;
+}
+
+/* io_uring user_data argument of a device's reads: slot and generation */
+static inline unsigned dev_uring_key(const input_dev_t *dev) {
+    return (unsigned)(dev - g_devs) | dev->uring_gen << 8;
+}
+
+/* ── Main event loop ───────────────────────────────────────────────── */
+
+static const key_mapping_t *find_mapping(const profile_t *prof, int keycode) {
+    int idx = prof->lookup[keycode];
+    return idx ? &prof->mappings[idx - 1] : NULL;
+}
+
+/* Mapping each held button's press picked, + 1; its repeats and release
+   go to the same one even if the modifiers changed in between */
+static unsigned char g_btn_map[MAX_PROFILES][KEY_CNT];
+
+static inline const key_mapping_t *press_mapping(const input_dev_t *dev, int code, int value) {
+    const profile_t *prof = dev_profile(dev);
+    unsigned char *latch = &g_btn_map[dev->prof][code];
+    if (value == 1)
+        *latch = prof->mod_lookup[g_mods][code];
+    return *latch ? &prof->mappings[*latch - 1] : NULL;
+}
+
+static void handle_key(int uinput_fd, const input_dev_t *dev, int code, int value) {
+    if (code < 0 || code >= KEY_CNT)
+        return;
+    const profile_t *prof = dev_profile(dev);
+    if (value != 2)
+        assign_bit(g_btn_state[dev->prof], code, value);
+
+    if (g_debug) {
+        fprintf(stderr, "[event] code=%d (%s) value=%d\n",
+                code, key_code_to_name(code), value);
+    }
+
+    const key_mapping_t *m = press_mapping(dev, code, value);
+    if (value == 0)
+        g_btn_map[dev->prof][code] = 0;
+    if (!m && code == prof->pointer.gesture.button) {
+        gesture_button(uinput_fd, dev->prof, &prof->pointer.gesture, value);
+        return;
+    }
+    if (!m && code == prof->pointer.sniper_button) {
+        if (g_debug)
+            fprintf(stderr, "  -> sniper %s\n", value ? "on" : "off");
+        return;
+    }
+    if (!m && test_bit(dev->keymap_fwd, code)) {
+        /* Already translated by the device keymap */
+        lat_note(-1, LAT_FORWARD);
+        emit_event(uinput_fd, EV_KEY, code, value);
+        emit_syn(uinput_fd);
+        return;
+    }
+    if (!m && test_bit(prof->passthrough, code)) {
+        /* Passed on: no mapping, or none for the modifiers held. The
+           hidraw device lives outside g_devs and has no modifier slot */
+        int slot = dev >= g_devs && dev < g_devs + MAX_INPUTS ? (int)(dev - g_devs) : -1;
+        uint8_t bit = value != 2 && slot >= 0 ? modkey_bit(code) : 0;
+        if (bit) {
+            uint8_t *mods = &g_dev_mods[slot];
+            *mods = value ? *mods | bit : *mods & (uint8_t)~bit;
+            kbd_update();
+        }
+        lat_note(-1, LAT_FORWARD);
+        emit_event(uinput_fd, EV_KEY, code, value);
+        emit_syn(uinput_fd);
+        if (g_cfg.expand.count) {
+            uint32_t hit = expand_key(&g_cfg.expand, code, value);
+            if (hit)
+                expand_type(uinput_fd, &g_cfg.expand, hit);
+            expand_pending(uinput_fd, &g_cfg.expand);
+        }
+        return;
+    }
+    if (!m) {
+        if (g_debug)
+            fprintf(stderr, "  -> no mapping, dropping\n");
+        g_io.discarded++;
+        return;
+    }
+
+    int map = dev->prof * MAX_MAPPINGS + (int)(m - prof->mappings);
+    if (m->command[0] != '\0') {
+        /* Command mode: fire on key-down only */
+        if (value == 1) {
+            if (g_debug)
+                fprintf(stderr, "  -> exec: %s\n", m->command);
+            exec_command(m->command);
+            lat_note(map, LAT_COMMAND);
+        }
+    } else if (m->num_keys > 0) {
+        /* Key combo mode */
+        if (g_debug)
+            fprintf(stderr, "  -> combo: %s (%d keys)\n", m->description, m->num_keys);
+        lat_note(map, LAT_COMBO);
+        if (m->socd) {
+            socd_key(uinput_fd, prof, &g_socd[dev->prof][m->socd - 1],
+                     g_mod_skipped[dev->prof], m, value);
+            return;
+        }
+        switch (value) {
+            case 1: emit_key_down(uinput_fd, m, &g_mod_skipped[dev->prof][code]); break;
+            case 0: emit_key_up(uinput_fd, m, &g_mod_skipped[dev->prof][code]);   break;
+            case 2: emit_key_repeat(uinput_fd, m); break;
+        }
+    }
+}
+
+/* ── Keymap offload ────────────────────────────────────────────────── */
+
+/*
+ * 1:1 mappings are written into the device's own scancode -> keycode table
+ * with EVIOCSKEYCODE_V2, so the kernel emits the target key directly.
+ * If every mapping is offloaded the device is not grabbed at all and
+ * unmapped scancodes are set to KEY_RESERVED, which the input core drops,
+ * matching what the grab did. Otherwise the device stays grabbed and the
+ * already translated keys are forwarded unchanged. Original entries are
+ * saved and written back when the device is released.
+ */
+static int keymap_full_offload(const profile_t *prof) {
+    /* A keyboard left ungrabbed with its other scancodes reserved
+       would stop typing; the sniper and gesture buttons have to reach us */
+    if (prof->keyboard || prof->pointer.sniper_button || prof->pointer.gesture.button)
+        return 0;
+    /* Passed-through buttons would be reserved with the unmapped ones */
+    for (size_t i = 0; i < sizeof(prof->passthrough); i++) {
+        if (prof->passthrough[i])
+            return 0;
+    }
+    for (int i = 0; i < prof->num_mappings; i++) {
+        if (!prof->mappings[i].kernel)
+            return 0;
+    }
+    return prof->num_mappings > 0;
+}
+
+static void keymap_apply(input_dev_t *dev, int fd, int full) {
+    const profile_t *prof = dev_profile(dev);
+    int remapped = 0, reserved = 0;
+
+    dev->keymap_saved_n = 0;
+    memset(dev->keymap_fwd, 0, sizeof(dev->keymap_fwd));
+
+    for (unsigned idx = 0; ; idx++) {
+        struct input_keymap_entry ke = {0};
+        ke.flags = INPUT_KEYMAP_BY_INDEX;
+        ke.index = idx;
+        if (ioctl(fd, EVIOCGKEYCODE_V2, &ke) < 0)
+            break;
+        if (ke.keycode >= KEY_CNT)
+            continue;
+
+        const key_mapping_t *m = find_mapping(prof, ke.keycode);
+        unsigned newcode;
+        if (m && m->kernel)
+            newcode = m->keys[0];
+        else if (full && !m && ke.keycode != KEY_RESERVED &&
+                 !test_bit(prof->passthrough, ke.keycode))
+            newcode = KEY_RESERVED;
+        else
+            continue;
+
+        if (dev->keymap_saved_n == KEYMAP_MAX) {
+            fprintf(stderr, "Keymap offload: more than %d entries, rest left alone\n",
+                    KEYMAP_MAX);
+            break;
+        }
+
+        struct input_keymap_entry set = ke;
+        set.flags = 0;
+        set.keycode = newcode;
+        if (ioctl(fd, EVIOCSKEYCODE_V2, &set) < 0) {
+            perror("EVIOCSKEYCODE_V2");
+            continue;
+        }
+        dev->keymap_saved[dev->keymap_saved_n].index = idx;
+        dev->keymap_saved[dev->keymap_saved_n++].keycode = (uint16_t)ke.keycode;
+
+        if (newcode == KEY_RESERVED) {
+            reserved++;
+        } else {
+            remapped++;
+            if (!full)
+                assign_bit(dev->keymap_fwd, newcode, 1);
+            if (g_debug)
+                fprintf(stderr, "[keymap] scancode %u: %s -> %s\n",
+                        idx, key_code_to_name(ke.keycode), key_code_to_name(newcode));
+        }
+    }
+
+    fprintf(stderr, "Keymap offload: %d scancode(s) remapped, %d disabled%s\n",
+            remapped, reserved, full ? ", device not grabbed" : "");
+}
+
+static void keymap_restore(input_dev_t *dev, int fd) {
+    /* Errors are expected here if the device is already gone */
+    for (int i = dev->keymap_saved_n - 1; i >= 0; i--) {
+        struct input_keymap_entry ke = {0};
+        ke.flags = INPUT_KEYMAP_BY_INDEX;
+        ke.index = dev->keymap_saved[i].index;
+        ke.keycode = dev->keymap_saved[i].keycode;
+        ioctl(fd, EVIOCSKEYCODE_V2, &ke);
+    }
+    dev->keymap_saved_n = 0;
+    memset(dev->keymap_fwd, 0, sizeof(dev->keymap_fwd));
+}
+
+/* ── Input sources ─────────────────────────────────────────────────── */
+
+static int read_records(input_dev_t *dev, struct input_event *buf, int max) {
+    unsigned char *p = (unsigned char *)buf;
+    size_t have = dev->part_len;
+    memcpy(p, dev->part, have);
+
+    g_io.reads++;
+    ssize_t n = read(dev->src.fd, p + have, max * sizeof(*buf) - have);
+    if (n <= 0)
+        return (int)n;
+    g_io.bytes_in += (unsigned long)n;
+
+    have += (size_t)n;
+    int count = (int)(have / sizeof(*buf));
+    dev->part_len = have % sizeof(*buf);
+    memcpy(dev->part, p + count * sizeof(*buf), dev->part_len);
+    if (count == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return count;
+}
+
+static void close_fd(input_dev_t *dev) {
+    close(dev->src.fd);
+}
+
+/*
+ * Ask evdev to deliver only what we act on: SYN frames plus the key codes
+ * of mapped and passthrough buttons (and keys the device keymap translated
+ * for us).
+ * Frames left empty by the mask, like a press of an unmapped button or a
+ * bare MSC_SCAN, then don't wake us at all. A passive device gets SYN
+ * only, so nothing is queued for it. The pointer interface is forwarded
+ * whole, so it only loses MSC_SCAN. Kernels before 4.4 lack EVIOCSMASK;
+ * the userspace filter still applies there.
+ */
+static void evdev_set_mask(int fd, const input_dev_t *dev) {
+    const profile_t *prof = dev_profile(dev);
+    unsigned char types[EV_CNT / 8 + 1] = {0};
+    unsigned char keys[KEY_CNT / 8 + 1] = {0};
+
+    assign_bit(types, EV_SYN, 1);
+    if (dev->pointer) {
+        assign_bit(types, EV_KEY, 1);
+        assign_bit(types, EV_REL, 1);
+    } else if (!dev->passive) {
+        assign_bit(types, EV_KEY, 1);
+        for (int i = 0; i < prof->num_mappings; i++)
+            assign_bit(keys, prof->mappings[i].button, 1);
+        assign_bit(keys, prof->pointer.sniper_button, prof->pointer.sniper_button != 0);
+        assign_bit(keys, prof->pointer.gesture.button, prof->pointer.gesture.button != 0);
+        for (size_t i = 0; i < sizeof(keys); i++)
+            keys[i] |= dev->keymap_fwd[i] | prof->passthrough[i];
+    }
+
+    /* type 0 (EV_SYN) selects the mask over event types */
+    struct input_mask mask = { 0, sizeof(types), (uintptr_t)types };
+    if (ioctl(fd, EVIOCSMASK, &mask) < 0) {
+        if (g_debug)
+            perror("EVIOCSMASK");
+        return;
+    }
+    if (dev->pointer)
+        return;
+    mask.type = EV_KEY;
+    mask.codes_size = sizeof(keys);
+    mask.codes_ptr = (uintptr_t)keys;
+    if (ioctl(fd, EVIOCSMASK, &mask) < 0 && g_debug)
+        perror("EVIOCSMASK");
+}
+
+static int evdev_open(input_dev_t *dev) {
+    int fd = open(dev->node.path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", dev->node.path, strerror(errno));
+        return -1;
+    }
+
+    /* The keymap belongs to the side-button interface */
+    int offload = g_keymap_offload && !dev->pointer;
+    int full = offload && keymap_full_offload(dev_profile(dev));
+
+    /* Grab device for exclusive access */
+    if (!full && ioctl(fd, EVIOCGRAB, 1) < 0) {
+        perror("EVIOCGRAB");
+        close(fd);
+        return -1;
+    }
+
+    dev->passive = full;
+    if (offload)
+        keymap_apply(dev, fd, full);
+    evdev_set_mask(fd, dev);
+    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(dev->keybits)), dev->keybits);
+
+    /* Stamp events on the clock we measure latency against */
+    int clk = CLOCK_MONOTONIC;
+    dev->mono_clock = ioctl(fd, EVIOCSCLOCKID, &clk) == 0;
+    return fd;
+}
+
+static void evdev_close(input_dev_t *dev) {
+    if (!dev->pointer)
+        keymap_restore(dev, dev->src.fd);
+    ioctl(dev->src.fd, EVIOCGRAB, 0);
+    close(dev->src.fd);
+}
+
+static int evdev_resync(input_dev_t *dev, unsigned char *keys, size_t len) {
+    if (ioctl(dev->src.fd, EVIOCGKEY(len), keys) < 0) {
+        perror("EVIOCGKEY");
+        return -1;
+    }
+    return 0;
+}
+
+static int trace_open(input_dev_t *dev) {
+    int fd = open(dev->arg, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        fprintf(stderr, "Cannot open trace: %s: %s\n", dev->arg, strerror(errno));
+    return fd;
+}
+
+/* "-" is stdin, a number is an inherited fd (e.g. one end of a socketpair),
+   anything else is opened as a path (e.g. a FIFO) */
+static int pipe_open(input_dev_t *dev) {
+    char *end;
+    long n = strtol(dev->arg, &end, 10);
+    int fd;
+    if (strcmp(dev->arg, "-") == 0)
+        fd = STDIN_FILENO;
+    else if (*dev->arg && *end == '\0' && n >= 0)
+        fd = (int)n;
+    else
+        fd = open(dev->arg, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+        fprintf(stderr, "Cannot open pipe: %s: %s\n", dev->arg, strerror(errno));
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * synth:<hz>[:<seconds>] generates pointer motion, one REL_X/REL_Y frame
+ * per poll interval of a mouse running at <hz>, stamped 0, 1/hz, 2/hz...
+ * There is nothing to read, so the fd is a placeholder on /dev/null.
+ */
+#define SYNTH_SECONDS 10
+
+static int synth_open(input_dev_t *dev) {
+    char *end;
+    long hz = strtol(dev->arg, &end, 10);
+    long secs = *end == ':' ? strtol(end + 1, &end, 10) : SYNTH_SECONDS;
+    if (hz <= 0 || hz > 1000000 || secs <= 0 || *end != '\0') {
+        fprintf(stderr, "Bad synth spec: %s (want <hz>[:<seconds>])\n", dev->arg);
+        return -1;
+    }
+    dev->synth_period_ns = 1000000000ULL / (uint64_t)hz;
+    dev->synth_frames = (unsigned long)hz * (unsigned long)secs;
+    dev->synth_seq = 0;
+    return open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+static int synth_next(input_dev_t *dev, struct input_event *buf, int max) {
+    /* A small circle, so deltas change sign like real hand motion */
+    static const signed char dx[16] = { 8, 7, 6, 3, 0, -3, -6, -7, -8, -7, -6, -3, 0, 3, 6, 7 };
+    int n = 0;
+
+    while (n + 3 <= max && dev->synth_seq < dev->synth_frames) {
+        uint64_t t = dev->synth_seq * dev->synth_period_ns;
+        unsigned phase = (unsigned)(dev->synth_seq & 15);
+        int code[3] = { REL_X, REL_Y, SYN_REPORT };
+        int value[3] = { dx[phase], dx[(phase + 4) & 15], 0 };
+        for (int k = 0; k < 3; k++) {
+            struct input_event *ev = &buf[n++];
+            ev->input_event_sec = (time_t)(t / 1000000000ULL);
+            ev->input_event_usec = (suseconds_t)(t % 1000000000ULL / 1000);
+            ev->type = k == 2 ? EV_SYN : EV_REL;
+            ev->code = (uint16_t)code[k];
+            ev->value = value[k];
+        }
+        dev->synth_seq++;
+    }
+    return n;
+}
+
+static const input_ops_t evdev_ops = {
+    "evdev", evdev_open, read_records, evdev_close, evdev_resync, 1, 1
+};
+static const input_ops_t trace_ops = {
+    "trace", trace_open, read_records, close_fd, NULL, 0, 0
+};
+static const input_ops_t pipe_ops = {
+    "pipe", pipe_open, read_records, close_fd, NULL, 1, 0
+};
+static const input_ops_t synth_ops = {
+    "synth", synth_open, synth_next, close_fd, NULL, 0, 0
+};
+
+static int g_explicit_inputs;           /* --input/--pointer-input: open only those */
+static source_t g_reconnect_src = { -1, NULL };
+static source_t g_hotplug_src = { -1, NULL };
+static long g_reconnect_ms = RECONNECT_MIN_MS;
+
+static int debounce_edge(input_dev_t *dev, const struct input_event *ev);
+static void debounce_reset(input_dev_t *dev, const unsigned char *keys);
+
+/*
+ * After SYN_DROPPED the kernel has thrown away part of the stream, so we
+ * may have missed presses or releases. Ask the device which keys are down
+ * right now and replay the difference for every mapped button it has.
+ * Sources that can't report their state get everything released.
+ */
+static void resync_keys(input_dev_t *dev, int uinput_fd) {
+    const profile_t *prof = dev_profile(dev);
+    unsigned char *btn_state = g_btn_state[dev->prof];
+    unsigned char keys[KEY_CNT / 8 + 1] = {0};
+    if (dev->ops->resync && dev->ops->resync(dev, keys, sizeof(keys)) < 0)
+        memset(keys, 0, sizeof(keys));
+
+    for (int i = 0; i < prof->num_mappings; i++) {
+        int code = prof->mappings[i].button;
+        if (!test_bit(dev->keybits, code))
+            continue;           /* lives on the other interface */
+        int now = test_bit(keys, code);
+        if (now != test_bit(btn_state, code)) {
+            if (g_debug)
+                fprintf(stderr, "[resync] %s -> %d\n", key_code_to_name(code), now);
+            handle_key(uinput_fd, dev, code, now);
+        }
+    }
+    /* Passthrough buttons: replay those too */
+    for (int code = 1; code < KEY_CNT; code++) {
+        if (test_bit(prof->passthrough, code) && test_bit(dev->keybits, code) &&
+            !prof->lookup[code] &&
+            test_bit(keys, code) != test_bit(btn_state, code))
+            handle_key(uinput_fd, dev, code, test_bit(keys, code));
+    }
+
+    int sniper = prof->pointer.sniper_button;
+    if (sniper && test_bit(dev->keybits, sniper) && !find_mapping(prof, sniper))
+        assign_bit(btn_state, sniper, test_bit(keys, sniper));
+    /* A stroke whose release was lost is dropped, not fired */
+    int gesture = prof->pointer.gesture.button;
+    if (gesture && test_bit(dev->keybits, gesture) && !find_mapping(prof, gesture)) {
+        assign_bit(btn_state, gesture, test_bit(keys, gesture));
+        if (!test_bit(keys, gesture) && g_gesture.prof == dev->prof)
+            g_gesture.prof = -1;
+    }
+    debounce_reset(dev, keys);
+}
+
+/*
+ * A device going away can't report its releases. If nothing else holds a
+ * button, everything down on the virtual keyboard is released in reverse
+ * press order; otherwise the device's buttons are released one by one so
+ * the other device's combos stay down.
+ */
+static void release_buttons(input_dev_t *dev) {
+    unsigned char *btn_state = g_btn_state[dev->prof];
+    int others = 0;
+    for (int p = 0; p < MAX_PROFILES; p++) {
+        for (size_t i = 0; i < sizeof(g_btn_state[p]); i++)
+            others |= g_btn_state[p][i] & (p == dev->prof ? ~dev->keybits[i] : 0xff);
+    }
+
+    if (!others) {
+        for (size_t i = 0; i < sizeof(g_btn_state[0]); i++)
+            btn_state[i] = 0;
+        memset(g_socd[dev->prof], 0, sizeof(g_socd[dev->prof]));
+        memset(g_btn_map[dev->prof], 0, sizeof(g_btn_map[dev->prof]));
+        memset(g_mod_skipped[dev->prof], 0, sizeof(g_mod_skipped[dev->prof]));
+        held_release_all(g_uinput_fd);
+        return;
+    }
+    for (int code = KEY_CNT - 1; code >= 0; code--) {
+        if (test_bit(btn_state, code) && test_bit(dev->keybits, code))
+            handle_key(g_uinput_fd, dev, code, 0);
+    }
+    out_flush(g_uinput_fd);
+}
+
+static inline uint64_t ev_raw_ns(const struct input_event *ev) {
+    return (uint64_t)ev->input_event_sec * 1000000000ULL + (uint64_t)ev->input_event_usec * 1000ULL;
+}
+
+/* Timestamp usable against now_ns(), or 0 */
+static inline uint64_t ev_time_ns(const input_dev_t *dev, const struct input_event *ev) {
+    return dev->mono_clock ? ev_raw_ns(ev) : 0;
+}
+
+/* 1: hand the event on, 0: swallowed; see debounce_edge() */
+static inline int debounce(input_dev_t *dev, const struct input_event *ev) {
+    return ev->code >= KEY_CNT || !dev_profile(dev)->debounce.ms[ev->code] ||
+           debounce_edge(dev, ev);
+}
+
+/*
+ * Keys a grabbed keyboard passes on are copied straight to the output
+ * queue and keep their frame: one SYN_REPORT and one latency sample for
+ * the run, and a single write for the whole batch. Everything else goes
+ * through debounce and handle_key() with its own SYN per key.
+ */
+static void handle_frame(input_dev_t *dev) {
+    const unsigned char *forward = dev_profile(dev)->forward;
+    const expand_t *ex = &g_cfg.expand;
+    unsigned char *btn_state = g_btn_state[dev->prof];
+    int run = 0;
+    for (int j = 0; j < dev->frame_len; j++) {
+        const struct input_event *ev = &dev->frame[j];
+        if (ev->code < KEY_CNT && test_bit(forward, ev->code)) {
+            emit_event(g_uinput_fd, EV_KEY, ev->code, ev->value);
+            if (ev->value != 2)
+                assign_bit(btn_state, ev->code, ev->value);
+            run = 1;
+            uint32_t hit = ex->count ? expand_key(ex, ev->code, ev->value) : 0;
+            if (hit) {
+                /* The key that completed it goes out in its own frame first */
+                g_ev_time_ns = ev_time_ns(dev, ev);
+                lat_note(-1, LAT_FORWARD);
+                emit_syn(g_uinput_fd);
+                run = 0;
+                expand_type(g_uinput_fd, ex, hit);
+            }
+            continue;
+        }
+        g_ev_time_ns = ev_time_ns(dev, ev);
+        if (run) {
+            lat_note(-1, LAT_FORWARD);
+            emit_syn(g_uinput_fd);
+            run = 0;
+        }
+        if (!debounce(dev, ev))
+            continue;
+        handle_key(g_uinput_fd, dev, ev->code, ev->value);
+    }
+    if (run) {
+        g_ev_time_ns = ev_time_ns(dev, &dev->frame[dev->frame_len - 1]);
+        lat_note(-1, LAT_FORWARD);
+        emit_syn(g_uinput_fd);
+    }
+    g_ev_time_ns = 0;
+    dev->frame_len = 0;
+}
+
+static void process_events(input_dev_t *dev, const struct input_event *buf, int count) {
+    for (int i = 0; i < count; i++) {
+        const struct input_event *ev = &buf[i];
+
+        if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+            /* Kernel buffer overflowed: resync against the device state
+               now, so a lost release can't leave a combo held, and
+               discard the rest of the broken frame */
+            dev->frame_len = 0;
+            dev->dropped = 1;
+            resync_keys(dev, g_uinput_fd);
+            continue;
+        }
+
+        if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+            if (dev->dropped)
+                dev->dropped = 0;
+            else
+                handle_frame(dev);
+            dev->frame_len = 0;
+            continue;
+        }
+
+        if (dev->dropped || ev->type != EV_KEY) {
+            g_io.discarded++;
+            continue;
+        }
+
+        /* Oversized frame: handle what we have rather than lose it */
+        if (dev->frame_len == EV_BATCH)
+            handle_frame(dev);
+        dev->frame[dev->frame_len++] = *ev;
+    }
+
+    g_io.events_in += count;
+    out_flush(g_uinput_fd);
+}
+
+/* ── Pointer passthrough ───────────────────────────────────────────── */
+
+/*
+ * The main pointer interface runs at up to 8 kHz, so its path does no
+ * per-event work beyond a table lookup: mapped buttons go to the mapping
+ * engine, everything else is copied into dev->pout as it arrives. Complete
+ * frames (up to pout_frame) are written to the virtual pointer with one
+ * write() per input batch; a frame split across reads waits in the queue
+ * for its SYN_REPORT, so consumers never see half a motion report.
+ * REL_X/REL_Y and the vertical wheel are summed over the frame and
+ * queued, transformed, right before its SYN_REPORT. Every forwarded
+ * pointer shares the one virtual pointer. Each batch is first sorted by
+ * classify_batch(), so frames of bare motion and unmapped clicks skip
+ * the per-event checks.
+ */
+static void pointer_flush(input_dev_t *dev) {
+    if (dev->pout_frame == 0)
+        return;
+    g_io.events_out += dev->pout_frame;
+    g_io.writes++;
+    if (write(g_ptr_uinput_fd, dev->pout, dev->pout_frame * sizeof(dev->pout[0])) < 0)
+        perror("write uinput pointer");
+    lat_commit(dev->pout_lat, dev->pout_nlat);
+    dev->pout_nlat = 0;
+
+    dev->pout_len -= dev->pout_frame;
+    memmove(dev->pout, dev->pout + dev->pout_frame, (size_t)dev->pout_len * sizeof(dev->pout[0]));
+    dev->pout_frame = 0;
+}
+
+static void pointer_queue(input_dev_t *dev, int type, int code, int value) {
+    struct input_event *ev = &dev->pout[dev->pout_len++];
+    memset(ev, 0, sizeof(*ev));
+    ev->type = type;
+    ev->code = code;
+    ev->value = value;
+}
+
+/* Set every forwarded button on the virtual pointer to its state in keys;
+   the input core drops the ones that don't change. Buttons mapped under
+   some modifiers only are forwarded unless a mapping holds them. */
+static void pointer_sync_buttons(input_dev_t *dev, const unsigned char *keys) {
+    pointer_flush(dev);
+    dev->pout_len = 0;
+    for (int code = BTN_LEFT; code <= BTN_TASK; code++) {
+        if (!dev_profile(dev)->mod_lookup[0][code] && !g_btn_map[dev->prof][code])
+            pointer_queue(dev, EV_KEY, code, keys ? test_bit(keys, code) : 0);
+    }
+    pointer_queue(dev, EV_SYN, SYN_REPORT, 0);
+    dev->pout_frame = dev->pout_len;
+    pointer_flush(dev);
+}
+
+/* ── Debounce ──────────────────────────────────────────────────────── */
+
+/*
+ * Worn switches chatter: one click reaches us as a burst of presses and
+ * releases a few milliseconds apart. Buttons with a debounce window are
+ * filtered on their event timestamps before anything else sees them:
+ *
+ *   eager     an edge is handed on at once and further edges inside the
+ *             window are swallowed; if the button ends the window in the
+ *             other state, that state is handed on at its end
+ *   deferred  presses are handed on at once, releases once the button has
+ *             stayed up for the window; a press inside it cancels the
+ *             release, so a switch that drops out while held can't
+ *             double-fire
+ *
+ * Neither delays a first press. A waiting state is delivered by the
+ * button's next event if that is past the deadline, else by a timerfd at
+ * the deadline, so it never depends on more input arriving. Sources
+ * without usable timestamps (all zero) pass through unfiltered.
+ */
+static source_t g_debounce_src = { -1, NULL };
+static uint32_t g_debounce_hits[MAX_PROFILES][KEY_CNT];    /* edges swallowed */
+
+static void debounce_arm(void) {
+    uint64_t next = 0;
+    for (int i = 0; i < MAX_INPUTS; i++) {
+        const input_dev_t *dev = &g_devs[i];
+        for (int w = 0; w < dev->db_nwait; w++) {
+            if (!next || dev->db_wait[w].due < next)
+                next = dev->db_wait[w].due;
+        }
+    }
+    if (g_debounce_src.fd < 0)
+        return;
+    /* An absolute zero disarms; a deadline already past fires at once */
+    struct itimerspec its = {0};
+    its.it_value.tv_sec = (time_t)(next / 1000000000ULL);
+    its.it_value.tv_nsec = (long)(next % 1000000000ULL);
+    if (timerfd_settime(g_debounce_src.fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+        perror("timerfd_settime");
+}
+
+static int debounce_wait(input_dev_t *dev, int code, uint64_t t) {
+    if (dev->db_nwait == DEBOUNCE_WAIT)
+        return -1;
+    uint64_t deadline = dev->db_t[code] +
+                        dev_profile(dev)->debounce.ms[code] * 1000000ULL;
+    uint64_t due = dev->mono_clock ? deadline : now_ns() + (deadline - t);
+    dev->db_wait[dev->db_nwait].code = (uint16_t)code;
+    dev->db_wait[dev->db_nwait++].due = due;
+    assign_bit(dev->db_pending, code, 1);
+    debounce_arm();
+    return 0;
+}
+
+static void debounce_unwait(input_dev_t *dev, int code) {
+    assign_bit(dev->db_pending, code, 0);
+    for (int i = 0; i < dev->db_nwait; i++) {
+        if (dev->db_wait[i].code == code) {
+            dev->db_wait[i] = dev->db_wait[--dev->db_nwait];
+            break;
+        }
+    }
+    debounce_arm();
+}
+
+/* Hand on a state outside of the event that caused it */
+static void debounce_emit(input_dev_t *dev, int code, int value) {
+    const profile_t *prof = dev_profile(dev);
+    if (!dev->pointer || press_mapping(dev, code, value) ||
+        code == prof->pointer.sniper_button) {
+        handle_key(g_uinput_fd, dev, code, value);
+        return;
+    }
+    if (dev->pout_len >= PTR_OUT_MAX - 5)
+        pointer_flush(dev);
+    if (dev->pout_len >= PTR_OUT_MAX - 5) {
+        g_io.discarded++;
+        return;
+    }
+    pointer_queue(dev, EV_KEY, code, value);
+}
+
+/* The window is over and the button is still in its other state */
+static void debounce_settle(input_dev_t *dev, int code) {
+    int value = !test_bit(dev->db_state, code);
+    uint64_t t = g_ev_time_ns;
+
+    debounce_unwait(dev, code);
+    assign_bit(dev->db_state, code, value);
+    dev->db_t[code] += dev_profile(dev)->debounce.ms[code] * 1000000ULL;
+    g_ev_time_ns = 0;
+    debounce_emit(dev, code, value);
+    g_ev_time_ns = t;
+}
+
+/* An edge of a button with a window: 1 to hand it on, 0 if swallowed or
+   waiting for its deadline */
+static int debounce_edge(input_dev_t *dev, const struct input_event *ev) {
+    int code = ev->code;
+    const debounce_cfg_t *db = &dev_profile(dev)->debounce;
+    uint64_t window = db->ms[code] * 1000000ULL;
+
+    uint64_t t = ev_raw_ns(ev);
+    if (test_bit(dev->db_pending, code) && t - dev->db_t[code] >= window)
+        debounce_settle(dev, code);
+
+    int state = test_bit(dev->db_state, code);
+    int pending = test_bit(dev->db_pending, code);
+    if (ev->value == 2)
+        return state;
+    int value = ev->value != 0;
+
+    if (value == state) {
+        /* Back where it was: what was waiting was chatter */
+        if (pending) {
+            debounce_unwait(dev, code);
+            g_debounce_hits[dev->prof][code] += db->deferred ? 2 : 1;
+        }
+        return 0;
+    }
+    if (pending)
+        return 0;
+
+    int hold = db->deferred ? !value
+                            : dev->db_t[code] && t - dev->db_t[code] < window;
+    if (hold) {
+        if (db->deferred)
+            dev->db_t[code] = t;
+        else
+            g_debounce_hits[dev->prof][code]++;
+        if (debounce_wait(dev, code, t) == 0)
+            return 0;
+    }
+    assign_bit(dev->db_state, code, value);
+    dev->db_t[code] = t;
+    return 1;
+}
+
+/* Forget waiting states; keys (NULL: all up) is what was handed on */
+static void debounce_reset(input_dev_t *dev, const unsigned char *keys) {
+    if (keys)
+        memcpy(dev->db_state, keys, sizeof(dev->db_state));
+    else
+        memset(dev->db_state, 0, sizeof(dev->db_state));
+    memset(dev->db_pending, 0, sizeof(dev->db_pending));
+    if (dev->db_nwait) {
+        dev->db_nwait = 0;
+        debounce_arm();
+    }
+}
+
+/* Deliver every state whose deadline is at or before now */
+static void debounce_expire(uint64_t now) {
+    for (int i = 0; i < MAX_INPUTS; i++) {
+        input_dev_t *dev = &g_devs[i];
+        if (!dev->db_nwait)
+            continue;
+        /* Outside a frame, settled pointer buttons need a frame of their own */
+        int idle = dev->pout_len == dev->pout_frame;
+        for (int w = 0; w < dev->db_nwait; ) {
+            if (dev->db_wait[w].due <= now)
+                debounce_settle(dev, dev->db_wait[w].code);
+            else
+                w++;
+        }
+        if (dev->pointer && idle && dev->pout_len > dev->pout_frame) {
+            pointer_queue(dev, EV_SYN, SYN_REPORT, 0);
+            dev->pout_frame = dev->pout_len;
+            pointer_flush(dev);
+        }
+    }
+    out_flush(g_uinput_fd);
+}
+
+static void on_debounce_tick(source_t *src, uint32_t events) {
+    (void)events;
+    timer_ack(src->fd);
+    debounce_expire(now_ns());
+}
+
+static void debounce_dump(const config_t *cfg) {
+    int header = 0;
+    for (int p = 0; p < cfg->num_profiles; p++) {
+        for (int code = 0; code < KEY_CNT; code++) {
+            if (!g_debounce_hits[p][code])
+                continue;
+            if (!header++)
+                fprintf(stderr, "Debounce, chatter edges swallowed:\n");
+            fprintf(stderr, "  %s%s%-24s %u\n",
+                    cfg->num_profiles > 1 ? cfg->profiles[p].label : "",
+                    cfg->num_profiles > 1 ? ": " : "",
+                    key_code_to_name(code), g_debounce_hits[p][code]);
+        }
+    }
+}
+
+/* ── Scroll stage ──────────────────────────────────────────────────── */
+
+/*
+ * Wheel motion is handled in hi-res units (120 per notch). Each frame's
+ * movement is scaled by speed and a curve over the notch rate, carrying
+ * the remainder like pointer motion, and REL_WHEEL is re-derived from the
+ * hi-res total so the two stay consistent. With kinetic scrolling a flick
+ * keeps going: once the wheel has been still for KINETIC_GAP_MS, a timerfd
+ * in the event loop emits the estimated velocity every interval and decays
+ * it, until it drops under a notch per second or a wheel or button press
+ * arrives. Nothing sleeps, so other input is handled between ticks.
+ */
+#define WHEEL_NOTCH     120
+#define KINETIC_GAP_MS  40
+#define SCROLL_RESET_NS 200000000ULL    /* pause after which rate and velocity start over */
+
+static source_t g_scroll_src = { -1, NULL };
+static struct {
+    const input_dev_t *dev;     /* pointer whose wheel moved last */
+    int64_t rem;                /* Q16 remainder of the scaled hi-res motion */
+    int32_t notch_acc;          /* hi-res emitted since the last REL_WHEEL step */
+    uint64_t last_t;            /* timestamp of the previous wheel frame */
+    double v;                   /* hi-res units per second, signed */
+    int gliding;
+    uint64_t glide_t;
+    double glide_rem;
+} g_scroll;
+
+/* REL_WHEEL_HI_RES and, when a notch's worth has built up, REL_WHEEL */
+static int scroll_events(int32_t hires, struct input_event *out) {
+    if (hires == 0)
+        return 0;
+    if ((hires > 0) != (g_scroll.notch_acc > 0))
+        g_scroll.notch_acc = 0;         /* direction changed */
+    g_scroll.notch_acc += hires;
+    int32_t notches = g_scroll.notch_acc / WHEEL_NOTCH;
+    g_scroll.notch_acc -= notches * WHEEL_NOTCH;
+
+    int n = 0;
+    memset(out, 0, 2 * sizeof(*out));
+    out[n].type = EV_REL;
+    out[n].code = REL_WHEEL_HI_RES;
+    out[n++].value = hires;
+    if (notches) {
+        out[n].type = EV_REL;
+        out[n].code = REL_WHEEL;
+        out[n++].value = notches;
+    }
+    return n;
+}
+
+static void scroll_stop(void) {
+    g_scroll.gliding = 0;
+    g_scroll.v = 0;
+}
+
+/* Scale one frame of wheel motion taken at time t; returns hi-res units */
+static int32_t scroll_frame(const scroll_cfg_t *sc, int32_t hires, uint64_t t) {
+    if (g_scroll.gliding)
+        scroll_stop();
+    uint64_t dt = g_scroll.last_t && t > g_scroll.last_t ? t - g_scroll.last_t : 0;
+    if (dt > SCROLL_RESET_NS)
+        dt = 0;
+    g_scroll.last_t = t;
+    if (!dt)
+        g_scroll.rem = 0;
+
+    uint64_t rate = dt ? (uint64_t)accel_abs(hires) * 1000000000ULL / WHEEL_NOTCH / dt : 0;
+    int64_t gain = sc->lut[rate < ACCEL_LUT - 1 ? rate : ACCEL_LUT - 1];
+    int64_t x = g_scroll.rem + (int64_t)(sc->invert ? -hires : hires) * gain;
+    int64_t out = (x + ACCEL_ONE / 2) >> ACCEL_SHIFT;
+    g_scroll.rem = x - out * ACCEL_ONE;
+
+    if (!sc->kinetic || g_scroll_src.fd < 0)
+        return (int32_t)out;
+
+    /* Velocity: running average of per-frame rates, restarted on a pause
+       or a change of direction */
+    double vi = dt ? (double)out * 1e9 / (double)dt : 0;
+    if (!dt || g_scroll.v == 0 || (vi > 0) != (g_scroll.v > 0))
+        g_scroll.v = vi;
+    else
+        g_scroll.v = (g_scroll.v + vi) / 2;
+    timer_arm(g_scroll_src.fd, KINETIC_GAP_MS);
+    return (int32_t)out;
+}
+
+static void on_scroll_tick(source_t *src, uint32_t events) {
+    (void)events;
+    timer_ack(src->fd);
+    if (!g_scroll.dev)
+        return;
+    const scroll_cfg_t *sc = &dev_profile(g_scroll.dev)->pointer.scroll;
+    double speed = g_scroll.v < 0 ? -g_scroll.v : g_scroll.v;
+    uint64_t now = now_ns();
+
+    if (!g_scroll.gliding) {
+        /* The wheel went still: glide if it was flicked hard enough */
+        if (!sc->kinetic || g_ptr_uinput_fd < 0 || speed < sc->kinetic_min_speed * WHEEL_NOTCH)
+            return;
+        g_scroll.gliding = 1;
+        g_scroll.glide_t = now;
+        g_scroll.glide_rem = 0;
+        timer_arm(src->fd, sc->kinetic_interval_ms);
+        return;
+    }
+
+    double amount = g_scroll.v * (double)(now - g_scroll.glide_t) / 1e9 + g_scroll.glide_rem;
+    int32_t hires = (int32_t)amount;
+    g_scroll.glide_t = now;
+    g_scroll.glide_rem = amount - hires;
+
+    struct input_event evs[3];
+    int n = scroll_events(hires, evs);
+    if (n) {
+        memset(&evs[n], 0, sizeof(evs[n]));
+        evs[n].type = EV_SYN;
+        evs[n++].code = SYN_REPORT;
+        g_io.events_out += n;
+        g_io.writes++;
+        if (write(g_ptr_uinput_fd, evs, n * sizeof(evs[0])) < 0)
+            perror("write uinput pointer");
+    }
+
+    g_scroll.v *= sc->kinetic_decay;
+    if (speed * sc->kinetic_decay < WHEEL_NOTCH)
+        scroll_stop();
+    else
+        timer_arm(src->fd, sc->kinetic_interval_ms);
+}
+
+/* Mapped buttons through the mapping engine, the rest straight to the
+   virtual pointer */
+static void pointer_resync(input_dev_t *dev) {
+    unsigned char keys[KEY_CNT / 8 + 1] = {0};
+    resync_keys(dev, g_uinput_fd);
+    if (dev->ops->resync && dev->ops->resync(dev, keys, sizeof(keys)) < 0)
+        memset(keys, 0, sizeof(keys));
+    pointer_sync_buttons(dev, keys);
+}
+
+/* SYN_REPORT: queue the frame's summed motion and wheel, then close it */
+static inline void pointer_frame_end(input_dev_t *dev, const profile_t *prof,
+                              const struct input_event *ev) {
+    if (dev->motion) {
+        const pointer_cfg_t *pc = &prof->pointer;
+        if (g_gesture.prof == dev->prof)
+            gesture_feed(&pc->gesture, dev->motion_dx, dev->motion_dy);
+        accel_apply(pc->lut[test_bit(g_btn_state[dev->prof], pc->sniper_button)],
+                    &dev->accel, &dev->motion_dx, &dev->motion_dy);
+        if (dev->motion_dx)
+            pointer_queue(dev, EV_REL, REL_X, dev->motion_dx);
+        if (dev->motion_dy)
+            pointer_queue(dev, EV_REL, REL_Y, dev->motion_dy);
+        dev->motion = dev->motion_dx = dev->motion_dy = 0;
+    }
+    if (dev->wheel) {
+        int32_t hires = (dev->wheel & 2) ? dev->wheel_hi : dev->wheel_lo * WHEEL_NOTCH;
+        g_scroll.dev = dev;
+        hires = scroll_frame(&prof->pointer.scroll, hires, ev_raw_ns(ev));
+        dev->pout_len += scroll_events(hires, &dev->pout[dev->pout_len]);
+        dev->wheel = dev->wheel_lo = dev->wheel_hi = 0;
+    }
+    if (dev->pout_len > dev->pout_frame) {
+        pointer_queue(dev, EV_SYN, SYN_REPORT, 0);
+        dev->pout_frame = dev->pout_len;
+        g_io.ptr_frames++;
+        uint64_t t = ev_time_ns(dev, ev);
+        if (t && dev->pout_nlat < PTR_OUT_MAX / 2)
+            dev->pout_lat[dev->pout_nlat++] = (lat_sample_t){ t, -1, LAT_MOTION };
+    }
+}
+
+/*
+ * Frames that hold nothing but REL_X/REL_Y, EV_MSC (which is dropped) and
+ * buttons no mapping or debounce window wants are the bulk of an 8 kHz
+ * stream, clicks included. Found from the batch masks, they are summed
+ * and closed without looking at their motion events one by one, and their
+ * buttons are copied as they are. Returns the index after the run of such
+ * frames starting at i.
+ */
+static int pointer_motion_frames(input_dev_t *dev, const profile_t *prof,
+                                 const struct input_event *chunk,
+                                 const ev_class_t *cl, int i) {
+    uint64_t motion = cl->rel_x | cl->rel_y;
+    uint64_t plain = motion | cl->msc | cl->key;
+    uint64_t from = ~0ULL << i;         /* events not yet handled */
+    for (uint64_t ends = cl->syn & from; ends; ends &= ends - 1) {
+        uint64_t below = (ends & -ends) - 1;
+        uint64_t frame = below & from;
+        uint64_t keys = cl->key & frame;
+        if ((frame & ~plain) || (keys && class_select_keys(chunk, keys, prof->engine)))
+            break;
+        if (keys) {
+            if (dev->pout_len + __builtin_popcountll(keys) > PTR_OUT_MAX - 5)
+                pointer_flush(dev);
+            if (dev->pout_len + __builtin_popcountll(keys) > PTR_OUT_MAX - 5)
+                break;
+            for (; keys; keys &= keys - 1) {
+                const struct input_event *ev = &chunk[__builtin_ctzll(keys)];
+                /* As below: a press ends a glide and any abbreviation */
+                if (ev->value == 1) {
+                    scroll_stop();
+                    expand_reset(&g_expand, EXPAND_ROOT);
+                }
+                dev->pout[dev->pout_len++] = *ev;
+            }
+        }
+        for (uint64_t m = cl->rel_x & frame; m; m &= m - 1)
+            dev->motion_dx += chunk[__builtin_ctzll(m)].value;
+        for (uint64_t m = cl->rel_y & frame; m; m &= m - 1)
+            dev->motion_dy += chunk[__builtin_ctzll(m)].value;
+        dev->motion |= (motion & frame) != 0;
+        if (cl->msc & frame)
+            g_io.discarded += (unsigned long)__builtin_popcountll(cl->msc & frame);
+        if (dev->pout_len >= PTR_OUT_MAX - 5)
+            pointer_flush(dev);
+        i = __builtin_ctzll(ends);
+        pointer_frame_end(dev, prof, &chunk[i++]);
+        from = ~below << 1;
+    }
+    return i;
+}
+
+static void process_pointer(input_dev_t *dev, const struct input_event *buf, int count) {
+    const profile_t *prof = dev_profile(dev);
+    uint64_t t_in = now_ns();
+    ev_class_t cl;
+
+    for (int base = 0; base < count; base += CLASSIFY_MAX) {
+        const struct input_event *chunk = &buf[base];
+        int n = count - base < CLASSIFY_MAX ? count - base : CLASSIFY_MAX;
+        classify_batch(chunk, n, &cl);
+
+        for (int i = 0; i < n; i++) {
+            if (!dev->dropped) {
+                i = pointer_motion_frames(dev, prof, chunk, &cl, i);
+                if (i == n)
+                    break;
+            }
+            const struct input_event *ev = &chunk[i];
+
+            if (ev->type == EV_SYN) {
+                if (ev->code == SYN_DROPPED) {
+                    dev->pout_len = dev->pout_frame;
+                    dev->motion = dev->motion_dx = dev->motion_dy = 0;
+                    dev->wheel = dev->wheel_lo = dev->wheel_hi = 0;
+                    dev->dropped = 1;
+                    pointer_resync(dev);
+                    continue;
+                }
+                if (ev->code != SYN_REPORT)
+                    continue;
+                if (dev->dropped) {
+                    dev->dropped = 0;
+                    dev->pout_len = dev->pout_frame;
+                    continue;
+                }
+                pointer_frame_end(dev, prof, ev);
+                continue;
+            }
+
+            if (dev->dropped || ev->type == EV_MSC) {
+                g_io.discarded++;
+                continue;
+            }
+
+            if (ev->type == EV_REL && (ev->code == REL_X || ev->code == REL_Y)) {
+                *(ev->code == REL_X ? &dev->motion_dx : &dev->motion_dy) += ev->value;
+                dev->motion = 1;
+                continue;
+            }
+            if (ev->type == EV_REL && ev->code == REL_WHEEL) {
+                dev->wheel_lo += ev->value;
+                dev->wheel |= 1;
+                continue;
+            }
+            if (ev->type == EV_REL && ev->code == REL_WHEEL_HI_RES) {
+                dev->wheel_hi += ev->value;
+                dev->wheel |= 2;
+                continue;
+            }
+
+            if (ev->type == EV_KEY && !debounce(dev, ev))
+                continue;
+
+            /* Grabbing a button ends a kinetic glide, and clicking may move
+               the text cursor away from an abbreviation */
+            if (ev->type == EV_KEY && ev->value == 1) {
+                scroll_stop();
+                expand_reset(&g_expand, EXPAND_ROOT);
+            }
+
+            if (ev->type == EV_KEY && (press_mapping(dev, ev->code, ev->value) ||
+                                       ev->code == prof->pointer.sniper_button ||
+                                       ev->code == prof->pointer.gesture.button)) {
+                g_ev_time_ns = ev_time_ns(dev, ev);
+                handle_key(g_uinput_fd, dev, ev->code, ev->value);
+                g_ev_time_ns = 0;
+                continue;
+            }
+
+            /* Leave room for motion, wheel and the SYN; a frame that fills
+               the whole queue on its own is cut, like the kernel does with
+               oversized frames */
+            if (dev->pout_len >= PTR_OUT_MAX - 5) {
+                pointer_flush(dev);
+                if (dev->pout_len >= PTR_OUT_MAX - 5) {
+                    g_io.discarded++;
+                    continue;
+                }
+            }
+            dev->pout[dev->pout_len++] = *ev;
+        }
+    }
+
+    g_io.events_in += count;
+    pointer_flush(dev);
+    out_flush(g_uinput_fd);
+    hist_add(&g_lat_ptr_batch, now_ns() - t_in);
+}
+
+static void dev_process(input_dev_t *dev, const struct input_event *buf, int count) {
+    if (dev->pointer)
+        process_pointer(dev, buf, count);
+    else
+        process_events(dev, buf, count);
+}
+
+static void schedule_reconnect(void) {
+    if (g_hotplug_src.fd >= 0) {
+        /* Hotplug events bring devices back; this is only a safety net */
+        fprintf(stderr, "Device not found, waiting for it to appear...\n");
+        timer_arm(g_reconnect_src.fd, HOTPLUG_RESCAN_SEC * 1000L);
+        return;
+    }
+    fprintf(stderr, "Device not found, retrying in %ldms...\n", g_reconnect_ms);
+    timer_arm(g_reconnect_src.fd, g_reconnect_ms);
+    g_reconnect_ms *= 2;
+    if (g_reconnect_ms > RECONNECT_SEC * 1000L)
+        g_reconnect_ms = RECONNECT_SEC * 1000L;
+}
+
+/* io_uring carries the side-button interface only */
+static int dev_uses_uring(const input_dev_t *dev) {
+    return g_use_uring && !dev->passive && !dev->pointer;
+}
+
+static void device_detach(input_dev_t *dev) {
+    if (dev->src.fd < 0)
+        return;
+    /* Losing the gesture button drops its stroke */
+    if (g_gesture.prof == dev->prof &&
+        test_bit(dev->keybits, dev_profile(dev)->pointer.gesture.button))
+        g_gesture.prof = -1;
+    release_buttons(dev);
+    debounce_reset(dev, NULL);
+    if (g_dev_mods[dev - g_devs]) {
+        g_dev_mods[dev - g_devs] = 0;
+        kbd_update();
+    }
+    if (dev_uses_uring(dev)) {
+        uring_cancel_read(dev_uring_key(dev));
+        uring_flush();
+        dev->uring_gen++;
+    } else if (dev->ops->pollable) {
+        loop_del(&dev->src);
+    }
+    dev->ops->close(dev);
+    dev->src.fd = -1;
+
+    /* Don't leave buttons held on the virtual pointer */
+    if (dev->pointer) {
+        dev->pout_len = dev->pout_frame;
+        pointer_sync_buttons(dev, NULL);
+        if (g_scroll.dev == dev) {
+            scroll_stop();
+            g_scroll.dev = NULL;
+        }
+    }
+}
+
+static void device_lost(input_dev_t *dev);
+
+static void on_device(source_t *src, uint32_t events) {
+    input_dev_t *dev = (input_dev_t *)src;
+    struct input_event buf[EV_BATCH];
+
+    (void)events;
+
+    /* Released earlier in this epoll batch, e.g. by a reload */
+    if (!dev->ops || dev->src.fd < 0)
+        return;
+
+    /* Passive devices are only registered for hangup */
+    if (dev->passive) {
+        device_lost(dev);
+        return;
+    }
+
+    /* Drain a pipe that hung up before treating it as gone */
+    g_io.wakeups++;
+    int n = dev->ops->next(dev, buf, EV_BATCH);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        return;
+    if (n <= 0) {
+        if (n < 0)
+            fprintf(stderr, "read %s: %s\n", dev->ops->name, strerror(errno));
+        /* Device likely disconnected */
+        device_lost(dev);
+        return;
+    }
+
+    dev_process(dev, buf, n);
+}
+
+/* Completions from the io_uring backend: evdev reads and uinput writes */
+static void on_uring(source_t *src, uint32_t events) {
+    (void)src; (void)events;
+    struct io_uring_cqe *cqe;
+
+    while ((cqe = uring_peek_cqe(&g_ring)) != NULL) {
+        uint64_t ud = cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        uring_cqe_seen(&g_ring);
+
+        unsigned arg = (unsigned)(ud >> 8);
+        switch (ud & 0xff) {
+        case UD_READ: {
+            int bid = (flags & IORING_CQE_F_BUFFER) ? (int)(flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+            unsigned slot = arg & 0xff;
+            input_dev_t *dev = &g_devs[slot < MAX_INPUTS ? slot : 0];
+            int stale = (slot >= MAX_INPUTS || arg != dev_uring_key(dev) || dev->src.fd < 0);
+            if (!stale && res > 0) {
+                g_io.wakeups++;
+                g_io.bytes_in += (unsigned long)res;
+                process_events(dev, g_uring_in[bid >= 0 ? bid : (int)(slot % URING_NBUF)],
+                               (int)(res / sizeof(struct input_event)));
+            }
+            if (bid >= 0)
+                uring_provide(bid);
+            if (stale || res == -ECANCELED)
+                break;
+
+            if (res < 0 && g_uring_multishot &&
+                (res == -EINVAL || res == -EOPNOTSUPP || res == -EBADFD)) {
+                fprintf(stderr, "io_uring: multishot read unsupported, using single-shot\n");
+                g_uring_multishot = 0;
+                uring_arm_read(dev->src.fd, arg);
+            } else if (res == -ENOBUFS) {
+                uring_arm_read(dev->src.fd, arg);
+            } else if (res <= 0) {
+                if (res < 0)
+                    fprintf(stderr, "read evdev: %s\n", strerror(-res));
+                device_lost(dev);
+            } else if (!g_uring_multishot || !(flags & IORING_CQE_F_MORE)) {
+                uring_arm_read(dev->src.fd, arg);
+            }
+            break;
+        }
+        case UD_WRITE:
+            if (res < 0 && res != -ECANCELED)
+                fprintf(stderr, "write uinput: %s\n", strerror(-res));
+            if (arg & UD_LAST) {
+                unsigned slot = arg & ~UD_LAST;
+                lat_commit(g_uring_lat[slot], g_uring_nlat[slot]);
+                g_uring_out_busy[slot] = 0;
+            }
+            break;
+        case UD_PBUF:
+            if (res < 0)
+                fprintf(stderr, "io_uring provide buffers: %s\n", strerror(-res));
+            break;
+        }
+    }
 
-static int find_device(void) {
-    DIR *dir = opendir("/dev/input");
+    uring_flush();
+}
+
+static source_t g_uring_src = { -1, NULL };
+
+static int setup_uring(void) {
+    if (uring_init(&g_ring, URING_ENTRIES) < 0) {
+        perror("io_uring_setup");
+        return -1;
+    }
+    g_uring_src.fd = g_ring.fd;
+    g_uring_src.handler = on_uring;
+    if (loop_add(&g_uring_src, EPOLLIN) < 0) {
+        uring_exit(&g_ring);
+        return -1;
+    }
+    for (int i = 0; i < URING_NBUF; i++)
+        uring_provide(i);
+    uring_flush();
+    fprintf(stderr, "Using io_uring backend\n");
+    return 0;
+}
+
+static int device_attach(input_dev_t *dev) {
+    dev->passive = 0;
+    dev->mono_clock = 0;
+    memset(dev->keybits, 0xff, sizeof(dev->keybits));
+    int fd = dev->ops->open(dev);
+    if (fd < 0)
+        return -1;
+
+    dev->src.fd = fd;
+    dev->src.handler = on_device;
+    dev->part_len = 0;
+    dev->frame_len = 0;
+    dev->dropped = 0;
+
+    /* A passive device only needs EPOLLHUP, which epoll always reports */
+    if (!dev->ops->pollable) {
+        /* driven by replay_loop() */
+    } else if (dev_uses_uring(dev)) {
+        uring_arm_read(fd, dev_uring_key(dev));
+        uring_flush();
+    } else if (loop_add(&dev->src, dev->passive ? 0 : EPOLLIN) < 0) {
+        dev->ops->close(dev);
+        dev->src.fd = -1;
+        return -1;
+    }
+
+    /* Buttons already down when it (re)appeared */
+    if (!dev->passive && dev->ops->resync) {
+        if (dev->pointer)
+            pointer_resync(dev);
+        else
+            resync_keys(dev, g_uinput_fd);
+        out_flush(g_uinput_fd);
+    }
+
+    if (dev->passive)
+        fprintf(stderr, "All mappings offloaded to the device keymap\n");
+    else if (dev->ops == &evdev_ops && dev->pointer)
+        fprintf(stderr, "Pointer %s grabbed, forwarding to the virtual pointer...\n",
+                dev->node.path);
+    else if (dev->ops == &evdev_ops)
+        fprintf(stderr, "Device %s grabbed, listening for events...\n", dev->node.path);
+    else
+        fprintf(stderr, "Reading events from %s %s\n", dev->ops->name, dev->arg);
+    return 0;
+}
+
+/* ── hidraw backend ────────────────────────────────────────────────── */
+
+/*
+ * Reads the keyboard interface matched by the first profile straight from
+ * /dev/hidraw and decodes the reports with the device's own descriptor,
+ * skipping hid-input and evdev on our path. The sibling evdev node is
+ * still grabbed (and never read) so the stock keycodes don't reach the
+ * desktop.
+ */
+typedef struct {
+    source_t src;
+    int evdev_fd;
+    hid_kbd_desc_t desc;
+    hid_kbd_state_t state;
+    input_dev_t keys;           /* what handle_key() sees: profile 0, no keymap */
+} hidraw_dev_t;
+
+static int g_use_hidraw = 0;
+static hidraw_dev_t g_hid = { .src = { -1, NULL }, .evdev_fd = -1 };
+
+/* Whether the node's HID identity in sysfs matches m; -1 if sysfs can't tell */
+static int hidraw_sysfs_match(const char *node, const device_match_t *m) {
+    char path[320], buf[1024];
+    snprintf(path, sizeof(path), "/sys/class/hidraw/%s/device/uevent", node);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return -1;
+    buf[n] = '\0';
+
+    node_info_t ni = {0};
+    unsigned bus, vendor, product;
+    int have_id = 0;
+    char *save;
+    for (char *line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        if (sscanf(line, "HID_ID=%x:%x:%x", &bus, &vendor, &product) == 3)
+            have_id = 1;
+        else if (strncmp(line, "HID_NAME=", 9) == 0)
+            snprintf(ni.name, sizeof(ni.name), "%s", line + 9);
+        else if (strncmp(line, "HID_PHYS=", 9) == 0)
+            snprintf(ni.phys, sizeof(ni.phys), "%s", line + 9);
+    }
+    if (!have_id)
+        return -1;
+    ni.id.vendor = (uint16_t)vendor;
+    ni.id.product = (uint16_t)product;
+    return match_node(m, &ni);
+}
+
+static int find_hidraw(hid_kbd_desc_t *desc, const device_match_t *m) {
+    DIR *dir = opendir("/dev");
     if (!dir) {
-        perror("opendir /dev/input");
+        perror("opendir /dev");
         return -1;
     }
 
     int perm_errors = 0;
     struct dirent *ent;
     while ((ent = readdir(dir)) != NULL) {
-        if (strncmp(ent->d_name, "event", 5) != 0)
+        if (strncmp(ent->d_name, "hidraw", 6) != 0)
+            continue;
+        /* Only open nodes sysfs doesn't rule out */
+        if (hidraw_sysfs_match(ent->d_name, m) == 0)
             continue;
 
         char path[280];
-        snprintf(path, sizeof(path), "/dev/input/%s", ent->d_name);
+        snprintf(path, sizeof(path), "/dev/%s", ent->d_name);
 
-        int fd = open(path, O_RDONLY);
+        int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
         if (fd < 0) {
             if (errno == EACCES) perm_errors++;
             continue;
         }
 
-        struct input_id id;
-        if (ioctl(fd, EVIOCGID, &id) < 0) {
+        struct hidraw_devinfo info;
+        node_info_t ni = {0};
+        if (ioctl(fd, HIDIOCGRAWINFO, &info) < 0) {
+            close(fd);
+            continue;
+        }
+        ni.id.vendor = (uint16_t)info.vendor;
+        ni.id.product = (uint16_t)info.product;
+        ioctl(fd, HIDIOCGRAWNAME(sizeof(ni.name)), ni.name);
+        ioctl(fd, HIDIOCGRAWPHYS(sizeof(ni.phys)), ni.phys);
+        if (!match_node(m, &ni)) {
+            close(fd);
+            continue;
+        }
+
+        struct hidraw_report_descriptor rd = {0};
+        if (ioctl(fd, HIDIOCGRDESCSIZE, &rd.size) < 0 ||
+            ioctl(fd, HIDIOCGRDESC, &rd) < 0 ||
+            hid_parse_rdesc(rd.value, rd.size, desc) <= 0) {
+            fprintf(stderr, "%s: no keyboard fields in report descriptor\n", path);
             close(fd);
             continue;
         }
 
-        if (id.vendor != RAZER_VENDOR || id.product != RAZER_PRODUCT) {
-            close(fd);
-            continue;
-        }
+        fprintf(stderr, "Found hidraw device: %s (%s) phys=%s, %d keyboard field(s)\n",
+                ni.name, path, ni.phys, desc->num_fields);
+        closedir(dir);
+        return fd;
+    }
+
+    closedir(dir);
+    if (perm_errors > 0)
+        fprintf(stderr, "Permission denied on %d device(s). "
+                "Are you running as root?\n", perm_errors);
+    return -1;
+}
+
+static void hidraw_lost(void);
+
+static void hid_emit(int code, int value) {
+    handle_key(g_uinput_fd, &g_hid.keys, code, value);
+}
+
+static void hidraw_detach(hidraw_dev_t *h) {
+    if (h->src.fd < 0)
+        return;
+    release_buttons(&h->keys);
+    loop_del(&h->src);
+    close(h->src.fd);
+    h->src.fd = -1;
+    if (h->evdev_fd >= 0) {
+        ioctl(h->evdev_fd, EVIOCGRAB, 0);
+        close(h->evdev_fd);
+        h->evdev_fd = -1;
+    }
+}
+
+static void on_hidraw(source_t *src, uint32_t events) {
+    hidraw_dev_t *h = (hidraw_dev_t *)src;
+    uint8_t buf[HID_MAX_DESCRIPTOR_SIZE];
+
+    g_io.reads++;
+    g_io.wakeups++;
+    ssize_t n = read(src->fd, buf, sizeof(buf));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        return;
+    if (n > 0)
+        g_io.bytes_in += (unsigned long)n;
+    if (n <= 0 || (events & (EPOLLHUP | EPOLLERR))) {
+        if (n < 0)
+            perror("read hidraw");
+        hidraw_lost();
+        return;
+    }
+
+    if (g_debug) {
+        fprintf(stderr, "[report]");
+        for (ssize_t i = 0; i < n; i++)
+            fprintf(stderr, " %02x", buf[i]);
+        fprintf(stderr, "\n");
+    }
+
+    int changes = hid_decode_report(&h->desc, &h->state, buf, (size_t)n, hid_emit);
+    if (changes > 0)
+        g_io.events_in += changes;
+    out_flush(g_uinput_fd);
+}
+
+static int hidraw_attach(hidraw_dev_t *h) {
+    const device_match_t *m = &g_cfg.profiles[0].match;
+    int fd = find_hidraw(&h->desc, m);
+    if (fd < 0)
+        return -1;
+
+    memset(&h->state, 0, sizeof(h->state));
+    memset(h->keys.keybits, 0xff, sizeof(h->keys.keybits));
+    h->src.fd = fd;
+    h->src.handler = on_hidraw;
+    if (loop_add(&h->src, EPOLLIN) < 0) {
+        close(fd);
+        h->src.fd = -1;
+        return -1;
+    }
+
+    h->evdev_fd = find_device(m);
+    if (h->evdev_fd >= 0 && ioctl(h->evdev_fd, EVIOCGRAB, 1) < 0) {
+        perror("EVIOCGRAB");
+        close(h->evdev_fd);
+        h->evdev_fd = -1;
+    }
+    if (h->evdev_fd < 0)
+        fprintf(stderr, "Warning: evdev node not grabbed, stock keycodes will leak\n");
+
+    fprintf(stderr, "Listening for HID reports...\n");
+    return 0;
+}
+
+/* ── Backend selection ─────────────────────────────────────────────── */
+
+/*
+ * Without --input/--pointer-input every node under /dev/input is matched
+ * against the profiles, and each one claimed (and wanted: a side-button
+ * interface with something mapped, a pointer with passthrough enabled)
+ * gets a slot of its own. Sources named on the command line take slots
+ * of their own and use the first profile.
+ */
+enum { SCAN_BUTTONS = 1, SCAN_POINTERS = 2 };
+static int g_scan = SCAN_BUTTONS | SCAN_POINTERS;  /* roles taken from /dev/input */
+static int g_peak;                  /* most scanned nodes attached at once */
+/* Nodes of devices that went away: a device that comes back under the
+   same node is re-opened from here without a scan */
+static char g_lost_paths[MAX_INPUTS][sizeof(((node_info_t *)0)->path)];
+
+/* Profile a node should be attached under, or -1 */
+static int scan_match(const config_t *cfg, const node_info_t *ni, int *pointer) {
+    int idx = match_profile(cfg, ni, pointer);
+    if (idx < 0)
+        return -1;
+    const profile_t *prof = &cfg->profiles[idx];
+    if (*pointer)
+        return (g_scan & SCAN_POINTERS) && prof->pointer.enabled ? idx : -1;
+    int used = prof->num_mappings > 0 ||
+               (prof->pointer.enabled && (prof->pointer.sniper_button ||
+                                          prof->pointer.gesture.button));
+    return (g_scan & SCAN_BUTTONS) && used ? idx : -1;
+}
+
+static input_dev_t *dev_by_path(const char *path) {
+    for (int i = 0; i < MAX_INPUTS; i++) {
+        if (g_devs[i].ops == &evdev_ops && strcmp(g_devs[i].node.path, path) == 0)
+            return &g_devs[i];
+    }
+    return NULL;
+}
+
+/* Nodes attached from the scan */
+static int dev_count(void) {
+    int n = 0;
+    for (int i = 0; i < MAX_INPUTS; i++)
+        n += g_devs[i].ops == &evdev_ops;
+    return n;
+}
+
+/* The pointer's output device is created the first time it is needed */
+static int input_attach(input_dev_t *dev) {
+    if (dev->pointer && g_ptr_uinput_fd < 0)
+        g_ptr_uinput_fd = g_output_path ? g_uinput_fd : setup_uinput_pointer();
+    if (dev->pointer && g_ptr_uinput_fd < 0)
+        return -1;
+    return device_attach(dev);
+}
+
+static int attach_cb(const node_info_t *ni, void *arg) {
+    (void)arg;
+    int pointer;
+    int prof = scan_match(&g_cfg, ni, &pointer);
+    if (prof < 0 || dev_by_path(ni->path))
+        return 0;
+
+    input_dev_t *dev = dev_alloc();
+    if (!dev) {
+        fprintf(stderr, "More than %d inputs, ignoring %s\n", MAX_INPUTS, ni->path);
+        return 0;
+    }
+    dev->ops = &evdev_ops;
+    dev->node = *ni;
+    dev->prof = prof;
+    dev->pointer = pointer;
+    fprintf(stderr, "Found device: %s (%s) phys=%s [%s%s]\n", ni->name, ni->path, ni->phys,
+            g_cfg.profiles[prof].label, pointer ? ", pointer" : "");
+    if (input_attach(dev) < 0)
+        dev->ops = NULL;
+    return 0;
+}
+
+/*
+ * Attach every input that isn't attached yet. Returns -1 while something
+ * is still missing: a source named on the command line, the hidraw node,
+ * or fewer scanned nodes than were attached at some point.
+ */
+static int backend_attach(void) {
+    int rc = 0;
+    if (g_use_hidraw && g_hid.src.fd < 0 && hidraw_attach(&g_hid) < 0)
+        rc = -1;
+
+    for (int i = 0; i < MAX_INPUTS; i++) {
+        input_dev_t *dev = &g_devs[i];
+        if (dev->fixed && dev->src.fd < 0 && input_attach(dev) < 0)
+            rc = -1;
+    }
+
+    if (!g_scan)
+        return rc;
+
+    /* Devices back under the node they left need no scan */
+    int lost = 0;
+    for (int i = 0; i < MAX_INPUTS; i++) {
+        node_info_t ni;
+        if (!g_lost_paths[i][0])
+            continue;
+        lost = 1;
+        if (node_probe(g_lost_paths[i], &ni) == 0)
+            attach_cb(&ni, NULL);
+        if (dev_by_path(g_lost_paths[i]))
+            g_lost_paths[i][0] = '\0';
+    }
+    int attached = dev_count();
+    if (!lost || attached == 0 || attached < g_peak) {
+        scan_nodes(attach_cb, NULL);
+        attached = dev_count();
+    }
+    if (attached > g_peak)
+        g_peak = attached;
+    if (attached == 0 || attached < g_peak)
+        return -1;
+    memset(g_lost_paths, 0, sizeof(g_lost_paths));
+    return rc;
+}
+
+static void backend_detach(void) {
+    for (int i = 0; i < MAX_INPUTS; i++) {
+        if (g_devs[i].ops)
+            device_detach(&g_devs[i]);
+    }
+    hidraw_detach(&g_hid);
+}
+
+static void device_lost(input_dev_t *dev) {
+    device_detach(dev);
+    if (!dev->ops->reconnect) {
+        fprintf(stderr, "End of %s input\n", dev->ops->name);
+        g_running = 0;
+        return;
+    }
+    fprintf(stderr, "%s disconnected: %s\n", dev->pointer ? "Pointer" : "Device",
+            dev->node.path);
+    if (!dev->fixed) {
+        for (int i = 0; i < MAX_INPUTS; i++) {
+            if (!g_lost_paths[i][0]) {
+                snprintf(g_lost_paths[i], sizeof(g_lost_paths[i]), "%s", dev->node.path);
+                break;
+            }
+        }
+        dev->ops = NULL;
+    }
+    g_reconnect_ms = RECONNECT_MIN_MS;
+    schedule_reconnect();
+}
+
+static void hidraw_lost(void) {
+    hidraw_detach(&g_hid);
+    fprintf(stderr, "Device disconnected\n");
+    g_reconnect_ms = RECONNECT_MIN_MS;
+    schedule_reconnect();
+}
+
+static void on_reconnect(source_t *src, uint32_t events) {
+    (void)events;
+    timer_ack(src->fd);
+    if (backend_attach() == 0)
+        g_reconnect_ms = RECONNECT_MIN_MS;
+    else
+        schedule_reconnect();
+}
+
+/* ── Keyboard monitor ──────────────────────────────────────────────── */
 
-        char phys[256] = {0};
-        ioctl(fd, EVIOCGPHYS(sizeof(phys)), phys);
+/*
+ * Mappings with "modifiers" depend on what is held on the real keyboards.
+ * While any exists, every keyboard node is opened read-only and without a
+ * grab, with an event mask of the eight modifier keys: other readers see
+ * everything as before, and typing doesn't wake us. Text expansion needs
+ * every key, so with expansions the mask lets them all through. Keyboards
+ * come and go with hotplug like the mice; our own virtual devices are
+ * skipped so combos and expansions can't feed back into what we read. A
+ * keyboard a profile grabs reports through its own events (g_dev_mods).
+ */
+#define MAX_KBDS 8
 
-        size_t plen = strlen(phys);
-        size_t slen = strlen(PHYS_SUFFIX);
-        if (plen >= slen && strcmp(phys + plen - slen, PHYS_SUFFIX) == 0) {
-            char name[256] = {0};
-            ioctl(fd, EVIOCGNAME(sizeof(name)), name);
-            fprintf(stderr, "Found device: %s (%s) phys=%s\n", name, path, phys);
-            closedir(dir);
-            return fd;
-        }
+typedef struct {
+    source_t src;
+    char path[sizeof(((node_info_t *)0)->path)];
+    uint8_t held;               /* modifier keys down, as in g_kbd_held */
+} kbd_t;
 
-        close(fd);
-    }
+static kbd_t g_kbds[MAX_KBDS];   /* empty path: free slot */
+static int g_kbd_monitor;       /* some mapping needs modifiers, or expansions */
+static int g_kbd_text;          /* expansions: every key is read */
 
-    closedir(dir);
-    if (perm_errors > 0)
-        fprintf(stderr, "Permission denied on %d device(s). "
-                "Are you running as root?\n", perm_errors);
-    return -1;
+static void kbd_update(void) {
+    uint8_t held = 0;
+    for (int i = 0; i < MAX_KBDS; i++)
+        held |= g_kbds[i].held;
+    for (int i = 0; i < MAX_INPUTS; i++)
+        held |= g_dev_mods[i];
+    g_kbd_held = held;
+    g_mods = (held | held >> 4) & (MOD_MASKS - 1);
 }
 
-static void detect_devices(void) {
-    DIR *dir = opendir("/dev/input");
-    if (!dir) { perror("opendir /dev/input"); return; }
-
-    printf("Scanning for Razer Naga V2 HyperSpeed (1532:00b4)...\n\n");
+static uint8_t kbd_state(int fd) {
+    unsigned char keys[KEY_CNT / 8 + 1] = {0};
+    uint8_t held = 0;
+    if (ioctl(fd, EVIOCGKEY(sizeof(keys)), keys) < 0)
+        return 0;
+    for (int i = 0; i < 8; i++) {
+        if (test_bit(keys, g_modkeys[i]))
+            held |= (uint8_t)(1 << i);
+    }
+    return held;
+}
 
-    struct dirent *ent;
-    int found = 0, perm_errors = 0;
-    while ((ent = readdir(dir)) != NULL) {
-        if (strncmp(ent->d_name, "event", 5) != 0)
-            continue;
+static void kbd_close(kbd_t *k) {
+    if (!k->path[0])
+        return;
+    loop_del(&k->src);
+    close(k->src.fd);
+    k->src.fd = -1;
+    k->path[0] = '\0';
+    k->held = 0;
+    kbd_update();
+}
 
-        char path[280];
-        snprintf(path, sizeof(path), "/dev/input/%s", ent->d_name);
+static void on_kbd(source_t *src, uint32_t events) {
+    kbd_t *k = (kbd_t *)src;
+    struct input_event buf[EV_BATCH];
+    (void)events;
 
-        int fd = open(path, O_RDONLY);
-        if (fd < 0) {
-            if (errno == EACCES) perm_errors++;
+    if (src->fd < 0)
+        return;
+    ssize_t n = read(src->fd, buf, sizeof(buf));
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0) {
+        fprintf(stderr, "Keyboard %s gone\n", k->path);
+        kbd_close(k);
+        return;
+    }
+    const expand_t *ex = &g_cfg.expand;
+    for (size_t i = 0; i < (size_t)n / sizeof(buf[0]); i++) {
+        const struct input_event *ev = &buf[i];
+        if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+            k->held = kbd_state(src->fd);
+            kbd_update();
+            expand_reset(&g_expand, EXPAND_ROOT);
+            g_expand_hit = 0;
             continue;
         }
+        if (ev->type != EV_KEY)
+            continue;
+        uint8_t bit = ev->value != 2 ? modkey_bit(ev->code) : 0;
+        if (bit) {
+            k->held = ev->value ? k->held | bit : k->held & (uint8_t)~bit;
+            kbd_update();
+        }
+        uint32_t hit = g_kbd_text ? expand_key(ex, ev->code, ev->value) : 0;
+        if (hit)
+            expand_type(g_uinput_fd, ex, hit);
+    }
+    if (g_kbd_text) {
+        expand_pending(g_uinput_fd, ex);
+        out_flush(g_uinput_fd);
+    }
+}
 
-        struct input_id id;
-        if (ioctl(fd, EVIOCGID, &id) < 0) { close(fd); continue; }
-
-        if (id.vendor == RAZER_VENDOR && id.product == RAZER_PRODUCT) {
-            char name[256] = {0}, phys[256] = {0};
-            ioctl(fd, EVIOCGNAME(sizeof(name)), name);
-            ioctl(fd, EVIOCGPHYS(sizeof(phys)), phys);
+/* capabilities/key: hex words of a long each, most significant first */
+static int sysfs_has_key(const char *event, int code) {
+    char dir[288], buf[512];
+    snprintf(dir, sizeof(dir), SYSFS_INPUT "/%s/device", event);
+    if (sysfs_read(dir, "capabilities/key", buf, sizeof(buf)) < 0)
+        return -1;
+    const int bits = (int)sizeof(long) * 8;
+    int words = 1;
+    for (const char *p = buf; *p; p++)
+        words += *p == ' ';
+    if (code / bits >= words)
+        return 0;
+    const char *p = buf;
+    for (int w = words - 1; w > code / bits; w--)
+        p = strchr(p, ' ') + 1;
+    return (int)(strtoul(p, NULL, 16) >> (code % bits)) & 1;
+}
 
-            size_t plen = strlen(phys);
-            size_t slen = strlen(PHYS_SUFFIX);
-            int is_side = (plen >= slen && strcmp(phys + plen - slen, PHYS_SUFFIX) == 0);
+static int node_is_keyboard(const node_info_t *ni) {
+    if (strncmp(ni->name, "naga-remap", 10) == 0 || dev_by_path(ni->path))
+        return 0;
+    const char *event = strrchr(ni->path, '/') + 1;
+    int a = sysfs_has_key(event, KEY_A), shift = sysfs_has_key(event, KEY_LEFTSHIFT);
+    if (a >= 0 && shift >= 0)
+        return a && shift;
 
-            printf("  %s\n    Name: %s\n    Phys: %s\n    Side buttons: %s\n\n",
-                   path, name, phys, is_side ? "YES" : "no");
-            found++;
-        }
-        close(fd);
-    }
+    unsigned char keys[KEY_CNT / 8 + 1] = {0};
+    int fd = open(ni->path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+    int rc = ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys);
+    close(fd);
+    return rc >= 0 && test_bit(keys, KEY_A) && test_bit(keys, KEY_LEFTSHIFT);
+}
 
-    closedir(dir);
-    if (!found) {
-        printf("No matching devices found.\n");
-        if (perm_errors > 0)
-            printf("\nPermission denied on %d device(s). "
-                   "Try running with sudo.\n", perm_errors);
-        else
-            printf("Is the mouse connected?\n");
-    }
+/* Modifier keys only, or every key while expansions are typed */
+static void kbd_mask(int fd) {
+    unsigned char types[EV_CNT / 8 + 1] = {0};
+    unsigned char keys[KEY_CNT / 8 + 1] = {0};
+    assign_bit(types, EV_SYN, 1);
+    assign_bit(types, EV_KEY, 1);
+    for (int i = 0; i < 8; i++)
+        assign_bit(keys, g_modkeys[i], 1);
+    if (g_kbd_text)
+        memset(keys, 0xff, sizeof(keys));
+    struct input_mask mask = { 0, sizeof(types), (uintptr_t)types };
+    ioctl(fd, EVIOCSMASK, &mask);
+    mask = (struct input_mask){ EV_KEY, sizeof(keys), (uintptr_t)keys };
+    ioctl(fd, EVIOCSMASK, &mask);
 }
 
-/* ── uinput virtual device ─────────────────────────────────────────── */
+static int kbd_add(const node_info_t *ni) {
+    kbd_t *k = NULL;
+    for (int i = 0; i < MAX_KBDS; i++) {
+        if (g_kbds[i].path[0] && strcmp(g_kbds[i].path, ni->path) == 0)
+            return 0;
+        if (!k && !g_kbds[i].path[0])
+            k = &g_kbds[i];
+    }
+    if (!k) {
+        fprintf(stderr, "More than %d keyboards, not watching %s\n", MAX_KBDS, ni->path);
+        return -1;
+    }
 
-static int setup_uinput(void) {
-    int fd = open("/dev/uinput", O_WRONLY);
+    int fd = open(ni->path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
     if (fd < 0) {
-        perror("open /dev/uinput");
+        fprintf(stderr, "Cannot open keyboard %s: %s\n", ni->path, strerror(errno));
         return -1;
     }
+    kbd_mask(fd);
 
-    if (ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0 ||
-        ioctl(fd, UI_SET_EVBIT, EV_SYN) < 0 ||
-        ioctl(fd, UI_SET_EVBIT, EV_REP) < 0) {
-        perror("UI_SET_EVBIT");
+    k->src.fd = fd;
+    k->src.handler = on_kbd;
+    if (loop_add(&k->src, EPOLLIN) < 0) {
         close(fd);
         return -1;
     }
+    snprintf(k->path, sizeof(k->path), "%s", ni->path);
+    k->held = kbd_state(fd);
+    kbd_update();
+    fprintf(stderr, "Watching %s on %s (%s)\n", g_kbd_text ? "typing" : "modifiers",
+            ni->path, ni->name);
+    return 0;
+}
+
+static int kbd_scan_cb(const node_info_t *ni, void *arg) {
+    (void)arg;
+    if (node_is_keyboard(ni))
+        kbd_add(ni);
+    return 0;
+}
 
-    /* Register all keys from our lookup table so X11/libinput
-       recognizes this as a proper keyboard device */
-    for (int i = 0; key_table[i].name != NULL; i++) {
-        ioctl(fd, UI_SET_KEYBIT, key_table[i].code);
+/* Start or stop watching keyboards as the config needs */
+static void kbd_setup(const config_t *cfg) {
+    g_kbd_text = cfg->expand.count > 0;
+    g_kbd_monitor = g_kbd_text;
+    for (int p = 0; p < cfg->num_profiles; p++) {
+        for (int i = 0; i < cfg->profiles[p].num_mappings; i++)
+            g_kbd_monitor |= cfg->profiles[p].mappings[i].modifiers != 0;
     }
+    for (int i = 0; i < MAX_KBDS; i++) {
+        /* Not watching what a profile grabbed: it would see nothing */
+        if (!g_kbd_monitor || dev_by_path(g_kbds[i].path))
+            kbd_close(&g_kbds[i]);
+        else if (g_kbds[i].path[0])
+            kbd_mask(g_kbds[i].src.fd);
+    }
+    if (g_kbd_monitor)
+        scan_nodes(kbd_scan_cb, NULL);
+}
 
-    struct uinput_setup setup = {0};
-    snprintf(setup.name, UINPUT_MAX_NAME_SIZE, "naga-remap virtual keyboard");
-    setup.id.bustype = BUS_VIRTUAL;
-    setup.id.vendor  = 0x1234;
-    setup.id.product = 0x5678;
-    setup.id.version = 1;
+/* ── Hotplug ───────────────────────────────────────────────────────── */
 
-    if (ioctl(fd, UI_DEV_SETUP, &setup) < 0) {
-        perror("UI_DEV_SETUP");
-        close(fd);
-        return -1;
+/*
+ * Devices coming back are noticed from kernel uevents (NETLINK_KOBJECT_UEVENT)
+ * the moment their node is added, and only that node is probed and
+ * attached. Where the netlink socket is unavailable, inotify on /dev/input
+ * (and /dev for hidraw) does the same job. The reconnect timer remains as
+ * a slow rescan in case an event is missed, and retries a node that could
+ * not be opened yet. The time from the event to the grab is kept in a
+ * histogram.
+ */
+#define HOTPLUG_BUF 8192
+
+static int g_hotplug_inotify;           /* fd is inotify rather than netlink */
+static hist_t g_lat_hotplug;
+
+static int hotplug_complete(void) {
+    return (!g_use_hidraw || g_hid.src.fd >= 0) && (!g_scan || dev_count() >= g_peak);
+}
+
+static void hotplug_added(const char *path, uint64_t t_event) {
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+
+    if (strncmp(name, "hidraw", 6) == 0) {
+        if (!g_use_hidraw || g_hid.src.fd >= 0)
+            return;
+        if (hidraw_attach(&g_hid) < 0) {
+            timer_arm(g_reconnect_src.fd, RECONNECT_MIN_MS);
+            return;
+        }
+    } else if (strncmp(name, "event", 5) == 0) {
+        node_info_t ni;
+        int pointer;
+        if (dev_by_path(path) || node_probe(path, &ni) < 0)
+            return;
+        if (!g_scan || scan_match(&g_cfg, &ni, &pointer) < 0) {
+            if (g_kbd_monitor && node_is_keyboard(&ni))
+                kbd_add(&ni);
+            return;
+        }
+        attach_cb(&ni, NULL);
+        if (!dev_by_path(path)) {
+            /* udev may not have set it up yet */
+            timer_arm(g_reconnect_src.fd, RECONNECT_MIN_MS);
+            return;
+        }
+        for (int i = 0; i < MAX_INPUTS; i++) {
+            if (strcmp(g_lost_paths[i], path) == 0)
+                g_lost_paths[i][0] = '\0';
+        }
+    } else {
+        return;
     }
 
-    if (ioctl(fd, UI_DEV_CREATE) < 0) {
-        perror("UI_DEV_CREATE");
-        close(fd);
-        return -1;
+    uint64_t d = now_ns() - t_event;
+    hist_add(&g_lat_hotplug, d);
+    fprintf(stderr, "%s ready %.1fms after it appeared\n", path, d / 1e6);
+    if (dev_count() > g_peak)
+        g_peak = dev_count();
+    if (hotplug_complete()) {
+        timer_arm(g_reconnect_src.fd, 0);
+        g_reconnect_ms = RECONNECT_MIN_MS;
     }
+}
 
-    /* Give udev time to create the device node */
-    usleep(100000);
+/* KEY=value fields of a kernel uevent, "add@/devices/..." header first */
+static void hotplug_uevent(char *msg, size_t len, uint64_t t) {
+    const char *action = NULL, *subsystem = NULL, *devname = NULL;
+    for (size_t off = 0; off < len; off += strlen(msg + off) + 1) {
+        const char *kv = msg + off;
+        if (strncmp(kv, "ACTION=", 7) == 0)
+            action = kv + 7;
+        else if (strncmp(kv, "SUBSYSTEM=", 10) == 0)
+            subsystem = kv + 10;
+        else if (strncmp(kv, "DEVNAME=", 8) == 0)
+            devname = kv + 8;
+    }
+    if (!action || !subsystem || !devname || strcmp(action, "add") != 0 ||
+        (strcmp(subsystem, "input") != 0 && strcmp(subsystem, "hidraw") != 0))
+        return;
 
-    fprintf(stderr, "Virtual input device created\n");
-    return fd;
+    char path[280];
+    snprintf(path, sizeof(path), "/dev/%s", devname);
+    hotplug_added(path, t);
 }
 
-static void emit_event(int fd, int type, int code, int value) {
-    struct input_event ev = {0};
-    ev.type = type;
-    ev.code = code;
-    ev.value = value;
-    if (write(fd, &ev, sizeof(ev)) < 0)
-        perror("write uinput");
-}
+static void on_hotplug(source_t *src, uint32_t events) {
+    (void)events;
+    char buf[HOTPLUG_BUF] __attribute__((aligned(__alignof__(struct inotify_event))));
 
-static void emit_syn(int fd) {
-    emit_event(fd, EV_SYN, SYN_REPORT, 0);
-}
+    for (;;) {
+        struct sockaddr_nl sender;
+        socklen_t slen = sizeof(sender);
+        ssize_t n = g_hotplug_inotify
+                  ? read(src->fd, buf, sizeof(buf))
+                  : recvfrom(src->fd, buf, sizeof(buf) - 1, 0,
+                             (struct sockaddr *)&sender, &slen);
+        if (n <= 0) {
+            if (n < 0 && errno != EAGAIN && errno != EINTR)
+                perror("hotplug");
+            return;
+        }
+        uint64_t t = now_ns();
 
-/* ── Key combo emission ────────────────────────────────────────────── */
+        if (!g_hotplug_inotify) {
+            /* Only the kernel speaks on this group */
+            if (sender.nl_pid != 0)
+                continue;
+            buf[n] = '\0';
+            hotplug_uevent(buf, (size_t)n, t);
+            continue;
+        }
 
-static void emit_key_down(int uinput_fd, const key_mapping_t *m) {
-    /* Press each key with its own SYN, like a real keyboard */
-    for (int i = 0; i < m->num_keys; i++) {
-        emit_event(uinput_fd, EV_KEY, m->keys[i], 1);
-        emit_syn(uinput_fd);
+        for (ssize_t off = 0; off < n; ) {
+            const struct inotify_event *ie = (const struct inotify_event *)(buf + off);
+            off += sizeof(*ie) + ie->len;
+            if (!ie->len)
+                continue;
+            char path[280];
+            snprintf(path, sizeof(path), "%s/%s",
+                     strncmp(ie->name, "hidraw", 6) == 0 ? "/dev" : "/dev/input", ie->name);
+            hotplug_added(path, t);
+        }
     }
 }
 
-static void emit_key_up(int uinput_fd, const key_mapping_t *m) {
-    /* Release in reverse order, each with its own SYN */
-    for (int i = m->num_keys - 1; i >= 0; i--) {
-        emit_event(uinput_fd, EV_KEY, m->keys[i], 0);
-        emit_syn(uinput_fd);
+static int setup_hotplug(void) {
+    struct sockaddr_nl addr = { .nl_family = AF_NETLINK, .nl_groups = 1 };
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    NETLINK_KOBJECT_UEVENT);
+    if (fd >= 0 && bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        fd = -1;
     }
-}
 
-static void emit_key_repeat(int uinput_fd, const key_mapping_t *m) {
-    /* Repeat only the last key (the non-modifier) */
-    if (m->num_keys > 0) {
-        emit_event(uinput_fd, EV_KEY, m->keys[m->num_keys - 1], 2);
-        emit_syn(uinput_fd);
+    g_hotplug_inotify = fd < 0;
+    if (g_hotplug_inotify) {
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        /* IN_ATTRIB: udev fixing up permissions after creation */
+        if (fd >= 0 && (inotify_add_watch(fd, "/dev/input", IN_CREATE | IN_ATTRIB) < 0 ||
+                        (g_use_hidraw && inotify_add_watch(fd, "/dev", IN_CREATE | IN_ATTRIB) < 0))) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd < 0) {
+        fprintf(stderr, "No hotplug events, polling for devices\n");
+        return -1;
+    }
+
+    g_hotplug_src.fd = fd;
+    g_hotplug_src.handler = on_hotplug;
+    if (loop_add(&g_hotplug_src, EPOLLIN) < 0) {
+        close(fd);
+        g_hotplug_src.fd = -1;
+        return -1;
     }
+    if (g_debug)
+        fprintf(stderr, "Watching for devices with %s\n",
+                g_hotplug_inotify ? "inotify" : "uevents");
+    return 0;
 }
 
-/* ── Command execution ─────────────────────────────────────────────── */
+/* SIGUSR1: dump counters and latency histograms */
+static void on_stats(void) {
+    fprintf(stderr, "I/O (%s): %lu events in, %lu out; syscalls: %lu epoll_wait, "
+            "%lu read, %lu write, %lu io_uring_enter\n",
+            g_use_uring ? "io_uring" : g_use_hidraw ? "hidraw" : "read/write",
+            g_io.events_in, g_io.events_out,
+            g_io.waits, g_io.reads, g_io.writes, g_io.enters);
+    fprintf(stderr, "Input: %lu wakeups, %lu bytes read, %lu events discarded\n",
+            g_io.wakeups, g_io.bytes_in, g_io.discarded);
+    if (g_io.ptr_frames)
+        fprintf(stderr, "Pointer: %lu frames forwarded\n", g_io.ptr_frames);
+    lat_dump(&g_cfg);
+    if (g_busy_poll_ms >= 0) {
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        double wall = (double)(now_ns() - g_spin.start_ns) / 1e9;
+        double cpu = (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+                     (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+        fprintf(stderr, "Busy-poll: %.3fs spinning, %lu empty polls, %lu fallbacks to "
+                "blocking; CPU %.3fs in %.3fs (%.1f%% of one core)\n",
+                g_spin.spin_ns / 1e9, g_spin.polls, g_spin.fallbacks, cpu, wall,
+                wall > 0 ? 100.0 * cpu / wall : 0.0);
+        fprintf(stderr, "Latency by pickup, event timestamp to uinput write (us):\n");
+        lat_print("after blocking", &g_lat_wake[0]);
+        lat_print("while spinning", &g_lat_wake[1]);
+    }
+    debounce_dump(&g_cfg);
+    if (g_lat_hotplug.count) {
+        fprintf(stderr, "Hotplug, node added to device grabbed (us):\n");
+        lat_print("reconnect", &g_lat_hotplug);
+    }
+}
 
-static void exec_command(const char *cmd) {
-    pid_t pid = fork();
-    if (pid < 0) {
-        perror("fork");
+/* SIGHUP: re-read the config, keeping the old one if the new one is bad */
+static void on_reload(void) {
+    static config_t next;
+    if (parse_config(g_config_path, &next) < 0 || !config_usable(&next)) {
+        expand_free(&next.expand);
+        fprintf(stderr, "Reload failed, keeping current config\n");
         return;
     }
-    if (pid == 0) {
-        /* Child: detach and redirect to /dev/null */
-        setsid();
-        int devnull = open("/dev/null", O_RDWR);
-        if (devnull >= 0) {
-            dup2(devnull, STDIN_FILENO);
-            dup2(devnull, STDOUT_FILENO);
-            dup2(devnull, STDERR_FILENO);
-            if (devnull > 2) close(devnull);
+
+    /* Let waiting debounce states through under the old windows, then
+       release combos held under the old mappings before they go away */
+    debounce_expire(UINT64_MAX);
+    for (int p = 0; p < g_cfg.num_profiles; p++) {
+        for (int i = 0; i < g_cfg.profiles[p].num_mappings; i++) {
+            const key_mapping_t *m = &g_cfg.profiles[p].mappings[i];
+            int down = m->socd ? g_socd[p][m->socd - 1].active == m->socd_slot + 1
+                               : test_bit(g_btn_state[p], m->button);
+            if (down && m->command[0] == '\0')
+                emit_key_up(g_uinput_fd, m, &g_mod_skipped[p][m->button]);
         }
-        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
-        _exit(127);
     }
-    /* Parent: fire-and-forget (SA_NOCLDWAIT handles reaping) */
-}
+    out_flush(g_uinput_fd);
+    memset(g_btn_state, 0, sizeof(g_btn_state));
+    memset(g_socd, 0, sizeof(g_socd));
+    memset(g_btn_map, 0, sizeof(g_btn_map));
+    memset(g_mod_skipped, 0, sizeof(g_mod_skipped));
+    g_gesture.prof = -1;
+    memset(g_lat_map, 0, sizeof(g_lat_map));
+    memset(g_debounce_hits, 0, sizeof(g_debounce_hits));
+    scroll_stop();
 
-/* ── Main event loop ───────────────────────────────────────────────── */
+    /* Let go of nodes no profile wants any more while the old one is
+       still in place, and find the new profile of the others */
+    int prof[MAX_INPUTS];
+    for (int i = 0; i < MAX_INPUTS; i++) {
+        input_dev_t *dev = &g_devs[i];
+        int pointer;
+        prof[i] = dev->fixed ? 0 : -1;
+        if (dev->ops != &evdev_ops)
+            continue;
+        prof[i] = scan_match(&next, &dev->node, &pointer);
+        if (prof[i] < 0 || pointer != dev->pointer) {
+            fprintf(stderr, "Releasing %s\n", dev->node.path);
+            device_detach(dev);
+            dev->ops = NULL;
+        }
+    }
+    /* No typing state may outlive the table it points into */
+    expand_reset(&g_expand, EXPAND_ROOT);
+    g_expand_hit = 0;
+    expand_free(&g_cfg.expand);
+    g_cfg = next;
+    g_peak = 0;
+    memset(g_lost_paths, 0, sizeof(g_lost_paths));
 
-static const key_mapping_t *find_mapping(const config_t *cfg, int keycode) {
-    for (int i = 0; i < cfg->num_mappings; i++) {
-        if (cfg->mappings[i].button == keycode)
-            return &cfg->mappings[i];
+    for (int i = 0; i < MAX_INPUTS; i++) {
+        input_dev_t *dev = &g_devs[i];
+        if (!dev->ops)
+            continue;
+        dev->prof = prof[i];
+        if (dev->ops != &evdev_ops || dev->pointer)
+            continue;
+        if (g_keymap_offload) {
+            /* The device keymap still holds the old mappings: re-attach
+               to reprogram it */
+            device_detach(dev);
+            dev->ops = NULL;
+        } else {
+            evdev_set_mask(dev->src.fd, dev);
+        }
     }
-    return NULL;
+
+    /* Nodes the new profiles claim, and those released above */
+    if (backend_attach() < 0)
+        schedule_reconnect();
+    kbd_setup(&g_cfg);
 }
 
-static void run_loop(int evdev_fd, int uinput_fd, const config_t *cfg) {
-    struct input_event ev;
+/* ── Busy polling ──────────────────────────────────────────────────── */
 
-    /* Grab device for exclusive access */
-    if (ioctl(evdev_fd, EVIOCGRAB, 1) < 0) {
-        perror("EVIOCGRAB");
+/*
+ * Every source is already non-blocking and in the epoll set, so busy
+ * polling is epoll_wait() with a zero timeout. Between empty polls the
+ * core is eased with a doubling run of pause instructions, up to about a
+ * microsecond, which keeps the sibling hyperthread and the memory bus
+ * usable without adding more than that to the pickup. After idle_ms
+ * without input the loop blocks again; the next event wakes it the usual
+ * way and starts another spin.
+ */
+#define BUSY_POLL_MAX_PAUSE 16
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+static uint64_t busy_poll_idle_ns(void) {
+    return g_busy_poll_ms > 0 ? (uint64_t)g_busy_poll_ms * 1000000ULL : UINT64_MAX;
+}
+
+static void busy_poll_setup(void) {
+    if (g_busy_poll_ms < 0)
         return;
+    if (g_busy_poll_cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(g_busy_poll_cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0)
+            fprintf(stderr, "Warning: can't pin to CPU %d: %s\n",
+                    g_busy_poll_cpu, strerror(errno));
     }
+    if (g_busy_poll_ms > 0)
+        fprintf(stderr, "Busy-polling, blocking after %ld ms idle\n", g_busy_poll_ms);
+    else
+        fprintf(stderr, "Busy-polling, never blocking\n");
+    g_spin.start_ns = now_ns();
+}
 
-    fprintf(stderr, "Device grabbed, listening for events...\n");
+static void run_loop(void) {
+    struct epoll_event events[16];
+    uint64_t idle_ns = busy_poll_idle_ns(), idle_since = now_ns();
+    unsigned pause = 1;
 
     while (g_running) {
-        ssize_t n = read(evdev_fd, &ev, sizeof(ev));
+        int n, spin = 0;
+        uint64_t idle = 0;
+        if (g_busy_poll_ms >= 0) {
+            idle = now_ns() - idle_since;
+            spin = idle < idle_ns;
+        }
+        if (spin) {
+            n = epoll_wait(g_epoll_fd, events, 16, 0);
+            if (n == 0) {
+                g_spin.polls++;
+                for (unsigned i = 0; i < pause; i++)
+                    cpu_relax();
+                if (pause < BUSY_POLL_MAX_PAUSE)
+                    pause <<= 1;
+                if (now_ns() - idle_since >= idle_ns) {
+                    g_spin.spin_ns += idle_ns;
+                    g_spin.fallbacks++;
+                }
+                continue;
+            }
+            g_spin.spin_ns += idle;
+            pause = 1;
+        } else {
+            g_io.waits++;
+            n = epoll_wait(g_epoll_fd, events, 16, -1);
+        }
         if (n < 0) {
             if (errno == EINTR) continue;
-            perror("read evdev");
-            break;  /* Device likely disconnected */
+            perror("epoll_wait");
+            break;
         }
-        if (n != sizeof(ev)) continue;
-        if (ev.type != EV_KEY) continue;
-
-        if (g_debug) {
-            fprintf(stderr, "[event] code=%d (%s) value=%d\n",
-                    ev.code, key_code_to_name(ev.code), ev.value);
+        g_wake_spin = spin;
+        for (int i = 0; i < n && g_running; i++) {
+            source_t *src = events[i].data.ptr;
+            src->handler(src, events[i].events);
         }
+        idle_since = now_ns();
+    }
+}
 
-        const key_mapping_t *m = find_mapping(cfg, ev.code);
-        if (!m) {
-            if (g_debug)
-                fprintf(stderr, "  -> no mapping, dropping\n");
-            continue;
+/*
+ * With --realtime, replayed frames are handed over when their timestamp
+ * comes due instead of as fast as they read. Timestamps are rebased onto
+ * CLOCK_MONOTONIC, so the latency histograms then cover the wakeup and
+ * the processing of each frame, as they do for a live device.
+ */
+static int g_realtime = 0;
+static int64_t g_replay_offset;         /* monotonic now - first event time */
+static int g_replay_started;
+
+static void replay_paced(input_dev_t *dev, struct input_event *buf, int n) {
+    int start = 0;
+    dev->mono_clock = 1;
+    for (int i = 0; i < n; i++) {
+        struct input_event *ev = &buf[i];
+        int64_t t = (int64_t)ev->input_event_sec * 1000000000LL +
+                    (int64_t)ev->input_event_usec * 1000LL;
+        if (!g_replay_started) {
+            g_replay_offset = (int64_t)now_ns() - t;
+            g_replay_started = 1;
         }
+        t += g_replay_offset;
+        ev->input_event_sec = (time_t)(t / 1000000000LL);
+        ev->input_event_usec = (suseconds_t)(t % 1000000000LL / 1000);
 
-        if (m->command[0] != '\0') {
-            /* Command mode: fire on key-down only */
-            if (ev.value == 1) {
-                if (g_debug)
-                    fprintf(stderr, "  -> exec: %s\n", m->command);
-                exec_command(m->command);
-            }
-        } else if (m->num_keys > 0) {
-            /* Key combo mode */
-            if (g_debug)
-                fprintf(stderr, "  -> combo: %s (%d keys)\n", m->description, m->num_keys);
-            switch (ev.value) {
-                case 1: emit_key_down(uinput_fd, m);   break;
-                case 0: emit_key_up(uinput_fd, m);     break;
-                case 2: emit_key_repeat(uinput_fd, m); break;
+        if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+            /* With --busy-poll, gaps shorter than the idle period are spun */
+            uint64_t now = now_ns();
+            g_wake_spin = g_busy_poll_ms >= 0 && (uint64_t)t < now + busy_poll_idle_ns();
+            if (g_wake_spin) {
+                uint64_t from = now;
+                for (unsigned pause = 1; now < (uint64_t)t; now = now_ns()) {
+                    for (unsigned k = 0; k < pause; k++)
+                        cpu_relax();
+                    if (pause < BUSY_POLL_MAX_PAUSE)
+                        pause <<= 1;
+                    g_spin.polls++;
+                }
+                g_spin.spin_ns += now - from;
+            } else {
+                struct timespec due = { (time_t)(t / 1000000000LL), (long)(t % 1000000000LL) };
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+                    ;
             }
+            dev_process(dev, buf + start, i + 1 - start);
+            start = i + 1;
+        }
+    }
+    if (start < n)
+        dev_process(dev, buf + start, n - start);
+}
+
+/* Non-pollable sources (trace files, synth) are drained as fast as they read */
+static void replay_loop(input_dev_t *dev) {
+    struct input_event buf[EV_BATCH];
+
+    /* Default timer slack (50us) would dwarf an 8 kHz poll interval */
+    if (g_realtime)
+        prctl(PR_SET_TIMERSLACK, 1UL);
+
+    for (unsigned long batch = 0; g_running; batch++) {
+        /* Signals are only delivered through the signalfd: poll it now and then */
+        if ((batch & 255) == 0)
+            on_signal(&g_signal_src, EPOLLIN);
+
+        int n = dev->ops->next(dev, buf, EV_BATCH);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (n <= 0) {
+            if (n < 0)
+                fprintf(stderr, "read %s: %s\n", dev->ops->name, strerror(errno));
+            device_lost(dev);
+            break;
         }
+        if (g_realtime)
+            replay_paced(dev, buf, n);
+        else
+            dev_process(dev, buf, n);
     }
+}
 
-    ioctl(evdev_fd, EVIOCGRAB, 0);
+static double elapsed_sec(const struct timespec *a, const struct timespec *b) {
+    return (double)(b->tv_sec - a->tv_sec) + (double)(b->tv_nsec - a->tv_nsec) / 1e9;
 }
 
 /* ── Cleanup ───────────────────────────────────────────────────────── */
 
 static void cleanup(void) {
-    if (g_evdev_fd >= 0) {
-        ioctl(g_evdev_fd, EVIOCGRAB, 0);
-        close(g_evdev_fd);
-        g_evdev_fd = -1;
+    backend_detach();
+    for (int i = 0; i < MAX_KBDS; i++)
+        kbd_close(&g_kbds[i]);
+    if (g_uinput_fd >= 0)
+        held_release_all(g_uinput_fd);
+    uring_exit(&g_ring);
+    if (g_reconnect_src.fd >= 0) {
+        close(g_reconnect_src.fd);
+        g_reconnect_src.fd = -1;
+    }
+    if (g_hotplug_src.fd >= 0) {
+        close(g_hotplug_src.fd);
+        g_hotplug_src.fd = -1;
+    }
+    if (g_scroll_src.fd >= 0) {
+        close(g_scroll_src.fd);
+        g_scroll_src.fd = -1;
+    }
+    if (g_debounce_src.fd >= 0) {
+        close(g_debounce_src.fd);
+        g_debounce_src.fd = -1;
     }
+    if (g_signal_src.fd >= 0) {
+        close(g_signal_src.fd);
+        g_signal_src.fd = -1;
+    }
+    if (g_epoll_fd >= 0) {
+        close(g_epoll_fd);
+        g_epoll_fd = -1;
+    }
+    if (g_ptr_uinput_fd >= 0 && !g_output_path) {
+        ioctl(g_ptr_uinput_fd, UI_DEV_DESTROY);
+        close(g_ptr_uinput_fd);
+    }
+    g_ptr_uinput_fd = -1;
     if (g_uinput_fd >= 0) {
-        ioctl(g_uinput_fd, UI_DEV_DESTROY);
+        if (!g_output_path)
+            ioctl(g_uinput_fd, UI_DEV_DESTROY);
         close(g_uinput_fd);
         g_uinput_fd = -1;
     }
+    expand_free(&g_cfg.expand);
 }
 
 /* ── Config path resolution ────────────────────────────────────────── */
@@ -469,25 +4426,112 @@ static void usage(const char *prog) {
         "Options:\n"
         "  -c <path>   Config file (default: " DEFAULT_CONFIG_PATH ")\n"
         "  -d          Debug mode (log all events to stderr)\n"
+        "  --io-uring  Use the io_uring I/O backend instead of read()/write()\n"
+        "  --hidraw    Read HID reports from /dev/hidraw instead of evdev\n"
+        "  --keymap-offload\n"
+        "              Program 1:1 mappings into the device keymap\n"
+        "  --input <source>\n"
+        "              evdev (default), trace:<file>, pipe:<-|fd|path>\n"
+        "              or synth:<hz>[:<seconds>]\n"
+        "  --pointer-input <source>\n"
+        "              Same, for the main pointer interface\n"
+        "  --realtime  Replay trace/synth input at its recorded rate\n"
+        "  --busy-poll <idle_ms>\n"
+        "              Spin instead of sleeping until input has been idle\n"
+        "              for idle_ms (0: always spin)\n"
+        "  --busy-poll-cpu <n>\n"
+        "              Pin the daemon to CPU n while busy-polling\n"
+        "  --output <path>\n"
+        "              Write emitted events to a file instead of uinput\n"
         "  --detect    Print matching devices and exit\n"
         "  -h          Show this help\n", prog);
 }
 
 /* ── Main ──────────────────────────────────────────────────────────── */
 
+/* "evdev" picks that role up from /dev/input, anything else takes a slot */
+static int parse_source(const char *spec, int pointer) {
+    static const struct { const char *prefix; const input_ops_t *ops; } sources[] = {
+        { "trace:", &trace_ops }, { "pipe:", &pipe_ops }, { "synth:", &synth_ops },
+    };
+    if (!g_explicit_inputs)
+        g_scan = 0;
+    g_explicit_inputs = 1;
+    if (strcmp(spec, "evdev") == 0) {
+        g_scan |= pointer ? SCAN_POINTERS : SCAN_BUTTONS;
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        size_t len = strlen(sources[i].prefix);
+        if (strncmp(spec, sources[i].prefix, len) != 0)
+            continue;
+        input_dev_t *dev = dev_alloc();
+        if (!dev) {
+            fprintf(stderr, "Too many inputs (at most %d)\n", MAX_INPUTS);
+            return -1;
+        }
+        dev->ops = sources[i].ops;
+        dev->arg = spec + len;
+        dev->pointer = pointer;
+        dev->fixed = 1;
+        return 0;
+    }
+    fprintf(stderr, "Unknown input source: %s\n", spec);
+    return -1;
+}
+
+/* The input whose end ends the run: the one replay_loop() drives, or a pipe */
+static input_dev_t *ending_source(int replayed) {
+    for (int i = 0; i < MAX_INPUTS; i++) {
+        input_dev_t *dev = &g_devs[i];
+        if (dev->fixed && !dev->ops->reconnect && (!replayed || !dev->ops->pollable))
+            return dev;
+    }
+    return NULL;
+}
+
 int main(int argc, char *argv[]) {
-    char config_path[512];
-    snprintf(config_path, sizeof(config_path), "%s", DEFAULT_CONFIG_PATH);
+    int detect = 0;
+    snprintf(g_config_path, sizeof(g_config_path), "%s", DEFAULT_CONFIG_PATH);
 
     /* Parse CLI args */
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--detect") == 0) {
-            detect_devices();
-            return 0;
+            detect = 1;
         } else if (strcmp(argv[i], "-d") == 0) {
             g_debug = 1;
+        } else if (strcmp(argv[i], "--io-uring") == 0) {
+            g_use_uring = 1;
+        } else if (strcmp(argv[i], "--hidraw") == 0) {
+            g_use_hidraw = 1;
+        } else if (strcmp(argv[i], "--keymap-offload") == 0) {
+            g_keymap_offload = 1;
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            if (parse_source(argv[++i], 0) < 0)
+                return 1;
+        } else if (strcmp(argv[i], "--pointer-input") == 0 && i + 1 < argc) {
+            if (parse_source(argv[++i], 1) < 0)
+                return 1;
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            g_realtime = 1;
+        } else if (strcmp(argv[i], "--busy-poll") == 0 && i + 1 < argc) {
+            char *end;
+            g_busy_poll_ms = strtol(argv[++i], &end, 10);
+            if (*end || g_busy_poll_ms < 0) {
+                fprintf(stderr, "--busy-poll takes an idle time in ms\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--busy-poll-cpu") == 0 && i + 1 < argc) {
+            char *end;
+            g_busy_poll_cpu = (int)strtol(argv[++i], &end, 10);
+            if (*end || g_busy_poll_cpu < 0 || g_busy_poll_cpu >= CPU_SETSIZE) {
+                fprintf(stderr, "--busy-poll-cpu takes a CPU number\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            g_output_path = argv[++i];
         } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
-            snprintf(config_path, sizeof(config_path), "%s", argv[++i]);
+            snprintf(g_config_path, sizeof(g_config_path), "%s", argv[++i]);
         } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
             usage(argv[0]);
             return 0;
@@ -498,46 +4542,148 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    setup_signals();
+    if (detect) {
+        /* Show what the config would pick up, or the stock Naga rules */
+        if (parse_config(g_config_path, &g_cfg) < 0 || g_cfg.num_profiles == 0) {
+            expand_free(&g_cfg.expand);
+            memset(&g_cfg, 0, sizeof(g_cfg));
+            default_profile(&g_cfg.profiles[g_cfg.num_profiles++]);
+        }
+        detect_devices(&g_cfg);
+        return 0;
+    }
+
+    if (g_use_hidraw && (g_use_uring || g_keymap_offload)) {
+        fprintf(stderr, "--hidraw cannot be combined with --io-uring or --keymap-offload\n");
+        return 1;
+    }
+    if (g_use_hidraw && !(g_scan & SCAN_BUTTONS)) {
+        fprintf(stderr, "--hidraw needs the side-button interface\n");
+        return 1;
+    }
+    /* hidraw replaces the evdev side-button interface */
+    if (g_use_hidraw)
+        g_scan &= ~SCAN_BUTTONS;
+    int replayed = 0;
+    for (int i = 0; i < MAX_INPUTS; i++) {
+        const input_dev_t *dev = &g_devs[i];
+        if (!dev->ops)
+            continue;
+        if (!dev->pointer && (g_use_hidraw || g_use_uring || g_keymap_offload)) {
+            fprintf(stderr, "--input %s only works with the default evdev backend\n",
+                    dev->ops->name);
+            return 1;
+        }
+        replayed += !dev->ops->pollable;
+    }
+    /* Only one source can drive replay_loop() */
+    if (replayed > 1) {
+        fprintf(stderr, "Only one trace or synth input can be replayed at a time\n");
+        return 1;
+    }
 
     /* Load config */
-    config_t cfg;
-    if (parse_config(config_path, &cfg) < 0)
+    if (parse_config(g_config_path, &g_cfg) < 0)
         return 1;
 
-    if (cfg.num_mappings == 0) {
+    if (!config_usable(&g_cfg)) {
         fprintf(stderr, "No valid mappings found, exiting\n");
         return 1;
     }
 
-    /* Set up virtual input device */
-    g_uinput_fd = setup_uinput();
-    if (g_uinput_fd < 0)
+    g_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (g_epoll_fd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    if (setup_signals() < 0) {
+        cleanup();
         return 1;
+    }
 
-    /* Main loop with reconnection */
-    while (g_running) {
-        g_evdev_fd = find_device();
-        if (g_evdev_fd < 0) {
-            fprintf(stderr, "Device not found, retrying in %ds...\n", RECONNECT_SEC);
-            for (int i = 0; i < RECONNECT_SEC && g_running; i++)
-                sleep(1);
-            continue;
-        }
+    g_reconnect_src.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    g_reconnect_src.handler = on_reconnect;
+    if (g_reconnect_src.fd < 0 || loop_add(&g_reconnect_src, EPOLLIN) < 0) {
+        perror("timerfd_create");
+        cleanup();
+        return 1;
+    }
 
-        run_loop(g_evdev_fd, g_uinput_fd, &cfg);
+    g_scroll_src.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    g_scroll_src.handler = on_scroll_tick;
+    if (g_scroll_src.fd < 0 || loop_add(&g_scroll_src, EPOLLIN) < 0) {
+        perror("timerfd_create");
+        cleanup();
+        return 1;
+    }
+
+    g_debounce_src.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    g_debounce_src.handler = on_debounce_tick;
+    if (g_debounce_src.fd < 0 || loop_add(&g_debounce_src, EPOLLIN) < 0) {
+        perror("timerfd_create");
+        cleanup();
+        return 1;
+    }
+
+    /* Without real devices there is nothing to wait for */
+    if (g_scan || g_use_hidraw)
+        setup_hotplug();
+
+    /* Set up virtual input device */
+    if (g_output_path) {
+        g_uinput_fd = open(g_output_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (g_uinput_fd < 0)
+            fprintf(stderr, "Cannot open output: %s: %s\n", g_output_path, strerror(errno));
+    } else {
+        g_uinput_fd = setup_uinput();
+    }
+    if (g_uinput_fd < 0) {
+        cleanup();
+        return 1;
+    }
+
+    if (g_use_uring && setup_uring() < 0) {
+        fprintf(stderr, "Falling back to read()/write() backend\n");
+        g_use_uring = 0;
+    }
 
-        close(g_evdev_fd);
-        g_evdev_fd = -1;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
 
-        if (g_running) {
-            fprintf(stderr, "Device disconnected, retrying in %ds...\n", RECONNECT_SEC);
-            for (int i = 0; i < RECONNECT_SEC && g_running; i++)
-                sleep(1);
+    input_dev_t *replay = ending_source(1);
+    if (backend_attach() < 0) {
+        input_dev_t *ends = ending_source(0);
+        if (ends && ends->src.fd < 0) {
+            cleanup();
+            return 1;
         }
+        schedule_reconnect();
     }
+    kbd_setup(&g_cfg);
+    busy_poll_setup();
 
+    if (replay)
+        replay_loop(replay);
+    else
+        run_loop();
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
     fprintf(stderr, "Shutting down...\n");
+    if (ending_source(0)) {
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        double wall = elapsed_sec(&t0, &t1);
+        double cpu = (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+                     (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+        fprintf(stderr, "Throughput: %lu events in %.3fs (%.0f events/s), "
+                "CPU %.3fs (%.1f%% of one core)\n",
+                g_io.events_in, wall, wall > 0 ? g_io.events_in / wall : 0.0, cpu,
+                wall > 0 ? 100.0 * cpu / wall : 0.0);
+        if (g_io.ptr_frames)
+            fprintf(stderr, "Pointer: %.0f ns CPU per frame\n", cpu * 1e9 / g_io.ptr_frames);
+    }
+    on_stats();
     cleanup();
     return 0;
 }
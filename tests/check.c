@@ -0,0 +1,409 @@
+/*
+ * check.c - Behavior checks for naga-remap
+ *
+ * Built by `make check` against the daemon's own source, so the static
+ * helpers and the header-only parsers are tested exactly as they ship.
+ * Needs no devices and no root: everything runs on in-memory input.
+ */
+
+#define main naga_remap_main
+#include "../naga-remap.c"
+#undef main
+
+static int g_checks, g_failed;
+
+#define CHECK(cond) do {                                                \
+        g_checks++;                                                     \
+        if (!(cond)) {                                                  \
+            g_failed++;                                                 \
+            fprintf(stderr, "%s:%d: check failed: %s\n",               \
+                    __FILE__, __LINE__, #cond);                         \
+        }                                                               \
+    } while (0)
+
+/* ── HID report descriptors ────────────────────────────────────────── */
+
+/* Boot keyboard: 8 modifier bits, a reserved byte, 6 key slots */
+static const uint8_t boot_kbd_rdesc[] = {
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01,
+    0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25, 0x01,
+    0x75, 0x01, 0x95, 0x08, 0x81, 0x02,
+    0x95, 0x01, 0x75, 0x08, 0x81, 0x01,
+    0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x25, 0x65,
+    0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00,
+    0xC0,
+};
+
+static struct { int code, value; } g_hid_out[16];
+static int g_hid_n;
+
+static void hid_record(int code, int value) {
+    if (g_hid_n < 16) {
+        g_hid_out[g_hid_n].code = code;
+        g_hid_out[g_hid_n].value = value;
+    }
+    g_hid_n++;
+}
+
+static void check_hid(void) {
+    hid_kbd_desc_t d;
+    hid_kbd_state_t st;
+    memset(&st, 0, sizeof(st));
+
+    CHECK(hid_parse_rdesc(boot_kbd_rdesc, sizeof(boot_kbd_rdesc), &d) == 2);
+    CHECK(!d.uses_report_ids);
+    CHECK(!d.fields[0].is_array && d.fields[0].count == 8 && d.fields[0].usage_min == 0xE0);
+    CHECK(d.fields[1].is_array && d.fields[1].count == 6 && d.fields[1].bit_offset == 16);
+
+    /* Left shift and 'a' down */
+    const uint8_t press[8] = { 0x02, 0, 0x04, 0, 0, 0, 0, 0 };
+    g_hid_n = 0;
+    CHECK(hid_decode_report(&d, &st, press, sizeof(press), hid_record) == 2);
+    CHECK(g_hid_n == 2);
+    CHECK(g_hid_out[0].code == KEY_A && g_hid_out[0].value == 1);
+    CHECK(g_hid_out[1].code == KEY_LEFTSHIFT && g_hid_out[1].value == 1);
+
+    /* The same report again changes nothing */
+    g_hid_n = 0;
+    CHECK(hid_decode_report(&d, &st, press, sizeof(press), hid_record) == 0);
+    CHECK(g_hid_n == 0);
+
+    /* ErrorRollOver leaves the held state alone */
+    const uint8_t rollover[8] = { 0, 0, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01 };
+    CHECK(hid_decode_report(&d, &st, rollover, sizeof(rollover), hid_record) == 0);
+    CHECK(g_hid_n == 0);
+
+    /* 'a' swapped for 'b' under shift: the release comes first */
+    const uint8_t swap[8] = { 0x02, 0, 0x05, 0, 0, 0, 0, 0 };
+    CHECK(hid_decode_report(&d, &st, swap, sizeof(swap), hid_record) == 2);
+    CHECK(g_hid_out[0].code == KEY_A && g_hid_out[0].value == 0);
+    CHECK(g_hid_out[1].code == KEY_B && g_hid_out[1].value == 1);
+
+    /* Malformed: an item running past the end */
+    const uint8_t truncated[] = { 0x05, 0x07, 0x19 };
+    CHECK(hid_parse_rdesc(truncated, sizeof(truncated), &d) == -1);
+}
+
+/* ── Latency histogram ─────────────────────────────────────────────── */
+
+static void check_hist(void) {
+    hist_t h;
+    memset(&h, 0, sizeof(h));
+    CHECK(hist_percentile(&h, 0.5) == 0);
+
+    /* Small values are exact */
+    for (uint64_t v = 0; v < HIST_SUB; v++)
+        CHECK(hist_bucket(v) == v && hist_bucket_upper((unsigned)v) == v + 1);
+
+    /* Every value lies under its bucket's upper bound, within 1/HIST_SUB */
+    for (uint64_t v = HIST_SUB; v < (1ULL << 36); v = v * 3 / 2 + 1) {
+        uint64_t up = hist_bucket_upper(hist_bucket(v));
+        CHECK(v < up && up - v <= v / HIST_SUB + 1);
+    }
+    CHECK(hist_bucket(~0ULL) == HIST_BUCKETS - 1);
+
+    /* 90 fast samples and 10 slow ones */
+    for (int i = 0; i < 90; i++)
+        hist_add(&h, 1000);
+    for (int i = 0; i < 10; i++)
+        hist_add(&h, 50000);
+    CHECK(h.count == 100 && h.sum == 590000 && h.max == 50000);
+    uint64_t p50 = hist_percentile(&h, 0.50), p99 = hist_percentile(&h, 0.99);
+    CHECK(p50 >= 1000 && p50 <= 1000 + 1000 / HIST_SUB);
+    CHECK(p99 == 50000);                /* capped at the largest sample */
+}
+
+/* ── Pointer transform ─────────────────────────────────────────────── */
+
+static void check_accel(void) {
+    int32_t lut[ACCEL_LUT];
+    accel_state_t st = {0, 0};
+
+    /* No curve at scale 1 passes motion through untouched */
+    accel_build(lut, NULL, 0, 1.0);
+    CHECK(lut[0] == ACCEL_ONE && lut[ACCEL_LUT - 1] == ACCEL_ONE);
+    int32_t dx = 7, dy = -3;
+    accel_apply(lut, &st, &dx, &dy);
+    CHECK(dx == 7 && dy == -3 && st.rx == 0 && st.ry == 0);
+
+    /* Interpolated between points, flat beyond both ends */
+    const double pts[2][2] = { { 2, 1.0 }, { 12, 3.0 } };
+    accel_build(lut, pts, 2, 1.0);
+    CHECK(lut[0] == ACCEL_ONE && lut[2] == ACCEL_ONE);
+    CHECK(lut[7] == 2 * ACCEL_ONE);
+    CHECK(lut[12] == 3 * ACCEL_ONE && lut[ACCEL_LUT - 1] == 3 * ACCEL_ONE);
+
+    /* Gain is clamped */
+    accel_build(lut, NULL, 0, 1000.0);
+    CHECK(lut[0] == (int32_t)(ACCEL_MAX_GAIN * ACCEL_ONE));
+
+    /* At half gain, slow motion still adds up in both directions */
+    accel_build(lut, NULL, 0, 0.5);
+    int32_t sx = 0, sy = 0;
+    for (int i = 0; i < 100; i++) {
+        dx = 1;
+        dy = -1;
+        accel_apply(lut, &st, &dx, &dy);
+        sx += dx;
+        sy += dy;
+    }
+    CHECK(sx == 50 && sy == -50);
+
+    /* Speed uses max + min/2 of the axes: (8, 4) reads as 10 */
+    accel_build(lut, pts, 2, 1.0);
+    memset(&st, 0, sizeof(st));
+    dx = 8;
+    dy = 4;
+    accel_apply(lut, &st, &dx, &dy);
+    CHECK(dx == 21 && dy == 10);        /* gain 2.6 at speed 10 */
+}
+
+/* ── Text expansion ────────────────────────────────────────────────── */
+
+static uint32_t expand_feed(const expand_t *ex, expand_state_t *st, const char *typed) {
+    uint32_t hit = 0;
+    for (const char *p = typed; *p; p++)
+        hit = expand_step(ex, st, *p);
+    return hit;
+}
+
+static void check_expand(void) {
+    const char *abbr[] = { "brb", "omw", "omw", "a b" };
+    const char *text[] = { "be right back", "on my way", "-", "-" };
+    expand_t ex;
+    expand_state_t st;
+
+    /* The second "omw" never fires and "a b" is not one word */
+    CHECK(expand_build(&ex, abbr, text, 4) == 2);
+    CHECK(!strcmp(ex.pool + ex.text[0], "be right back") && ex.len[0] == 3);
+
+    expand_reset(&st, EXPAND_ROOT);
+    CHECK(expand_feed(&ex, &st, "brb") == 1);
+    expand_reset(&st, EXPAND_ROOT);
+    CHECK(expand_feed(&ex, &st, "xbrb") == 0);          /* inside a word */
+    CHECK(expand_feed(&ex, &st, " omw") == 2);          /* after a space */
+    expand_reset(&st, EXPAND_ROOT);
+    CHECK(expand_feed(&ex, &st, "(brb") == 1);          /* after punctuation */
+
+    /* Backspace takes a character back */
+    expand_reset(&st, EXPAND_ROOT);
+    expand_feed(&ex, &st, "omx");
+    expand_back(&st);
+    CHECK(expand_step(&ex, &st, 'w') == 2);
+
+    /* Bytes past ASCII (a char that is signed here) end the word */
+    expand_reset(&st, EXPAND_ROOT);
+    CHECK(expand_step(&ex, &st, (char)0xE9) == 0 && st.depth == 0);
+    CHECK(expand_feed(&ex, &st, "brb") == 1);
+
+    expand_free(&ex);
+    CHECK(expand_build(&ex, abbr + 3, text + 3, 1) == 0);
+}
+
+/* ── Batch classifier ────────────────────────────────────────────── */
+
+static void check_classify(void) {
+    static const struct { uint16_t type, code; } kinds[] = {
+        { EV_SYN, SYN_REPORT }, { EV_SYN, SYN_DROPPED }, { EV_REL, REL_X },
+        { EV_REL, REL_Y }, { EV_REL, REL_WHEEL }, { EV_MSC, MSC_SCAN },
+        { EV_KEY, BTN_LEFT }, { EV_KEY, BTN_SIDE }, { EV_KEY, KEY_MAX },
+        { EV_ABS, ABS_X }, { EV_LED, LED_NUML },
+    };
+    const int nk = (int)(sizeof(kinds) / sizeof(kinds[0]));
+    struct input_event buf[CLASSIFY_MAX];
+    unsigned seed = 1;
+
+    /* The batch masks match classify_one() at every length and alignment */
+    for (int round = 0; round < 200; round++) {
+        memset(buf, 0, sizeof(buf));
+        for (int i = 0; i < CLASSIFY_MAX; i++) {
+            seed = seed * 1103515245u + 12345u;
+            int k = (int)(seed >> 16) % nk;
+            buf[i].type = kinds[k].type;
+            buf[i].code = kinds[k].code;
+            buf[i].value = (int32_t)seed;
+        }
+        int n = round % (CLASSIFY_MAX + 1);
+        ev_class_t batch, one;
+        memset(&one, 0, sizeof(one));
+        for (int i = 0; i < n; i++)
+            classify_one(&buf[i], i, &one);
+        classify_batch(buf, n, &batch);
+        CHECK(!memcmp(&batch, &one, sizeof(one)));
+    }
+
+    /* Only keys in the table, and anything past KEY_CNT */
+    unsigned char bits[KEY_CNT / 8 + 1] = {0};
+    bits[BTN_SIDE / 8] |= 1 << (BTN_SIDE % 8);
+    struct input_event keys[4] = {
+        { .type = EV_KEY, .code = BTN_LEFT }, { .type = EV_KEY, .code = BTN_SIDE },
+        { .type = EV_REL, .code = REL_X }, { .type = EV_KEY, .code = KEY_CNT },
+    };
+    ev_class_t cl;
+    classify_batch(keys, 4, &cl);
+    CHECK(cl.key == 0xb);
+    CHECK(class_select_keys(keys, cl.key, bits) == 0xa);
+}
+
+/* ── Stale events after a release ────────────────────────────────── */
+
+/*
+ * A reload or a lost keyboard can close a source while later events for
+ * it still sit in the same epoll batch. Their handlers must drop them.
+ */
+static void check_stale_events(void) {
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    struct input_event ev = { .type = EV_KEY, .code = KEY_1, .value = 1 };
+    CHECK(write(fds[1], &ev, sizeof(ev)) == (ssize_t)sizeof(ev));
+
+    /* Released by on_reload(): no ops, no fd */
+    input_dev_t *dev = dev_alloc();
+    CHECK(dev != NULL);
+    unsigned long wakeups = g_io.wakeups;
+    on_device(&dev->src, EPOLLIN);
+    dev->ops = &pipe_ops;               /* detached, fd already closed */
+    on_device(&dev->src, EPOLLIN);
+    dev->ops = NULL;
+    CHECK(g_io.wakeups == wakeups);
+
+    /* Closed keyboard watcher: the fd is forgotten and never read */
+    kbd_t *k = &g_kbds[0];
+    memset(k, 0, sizeof(*k));
+    snprintf(k->path, sizeof(k->path), "/dev/input/event-test");
+    k->src.fd = fds[0];
+    k->src.handler = on_kbd;
+    kbd_close(k);
+    CHECK(k->src.fd == -1 && !k->path[0]);
+    on_kbd(&k->src, EPOLLIN);
+
+    close(fds[1]);
+}
+
+/* ── Held modifiers in combos ────────────────────────────────────── */
+
+/* The keys of g_out[from..], SYN_REPORTs left out, as code * 2 + down */
+static int out_keys(int from, int *keys) {
+    int n = 0;
+    for (int i = from; i < g_out_len; i++) {
+        if (g_out[i].type == EV_KEY)
+            keys[n++] = g_out[i].code * 2 + g_out[i].value;
+    }
+    return n;
+}
+
+/*
+ * A modifier the user already holds is not pressed again for a combo,
+ * nor released after it; that is remembered per button, so another
+ * combo in between can't make the first one release it.
+ */
+static void check_mod_skipped(void) {
+    key_mapping_t copy = { .button = BTN_SIDE, .keys = { KEY_LEFTCTRL, KEY_C }, .num_keys = 2 };
+    key_mapping_t paste = { .button = BTN_EXTRA, .keys = { KEY_LEFTCTRL, KEY_V }, .num_keys = 2 };
+    uint8_t *skip_copy = &g_mod_skipped[0][copy.button];
+    uint8_t *skip_paste = &g_mod_skipped[0][paste.button];
+    int keys[8];
+
+    g_out_len = 0;
+    g_kbd_held = modkey_bit(KEY_LEFTCTRL);
+    emit_key_down(-1, &copy, skip_copy);
+    CHECK(out_keys(0, keys) == 1 && keys[0] == KEY_C * 2 + 1);
+
+    g_kbd_held = 0;
+    int from = g_out_len;
+    emit_key_down(-1, &paste, skip_paste);
+    CHECK(out_keys(from, keys) == 2 && keys[0] == KEY_LEFTCTRL * 2 + 1);
+
+    from = g_out_len;
+    emit_key_up(-1, &copy, skip_copy);
+    CHECK(out_keys(from, keys) == 1 && keys[0] == KEY_C * 2);
+
+    from = g_out_len;
+    emit_key_up(-1, &paste, skip_paste);
+    CHECK(out_keys(from, keys) == 2 && keys[1] == KEY_LEFTCTRL * 2);
+    CHECK(!*skip_copy && !*skip_paste);
+    g_out_len = 0;
+}
+
+/* ── SOCD groups ──────────────────────────────────────────────────── */
+
+/* A button whose mapping depends on the held modifiers stays out of groups */
+static void check_socd(void) {
+    static profile_t prof;
+    memset(&prof, 0, sizeof(prof));
+    const int buttons[] = { KEY_4, KEY_5, KEY_6, KEY_4 };
+    for (int i = 0; i < 4; i++) {
+        key_mapping_t *m = &prof.mappings[i];
+        m->button = buttons[i];
+        m->keys[0] = KEY_A + i;
+        m->num_keys = 1;
+    }
+    prof.mappings[3].modifiers = MOD_CTRL;
+    prof.num_mappings = 4;
+    prof.socd[0] = (socd_group_t){ { KEY_4, KEY_5, KEY_6 }, 3 };
+    prof.num_socd = 1;
+    compile_mappings(&prof);
+
+    CHECK(prof.socd[0].num_buttons == 2);
+    CHECK(prof.socd[0].buttons[0] == KEY_5 && prof.socd[0].buttons[1] == KEY_6);
+    CHECK(!prof.mappings[0].socd && !prof.mappings[3].socd);
+    CHECK(prof.mappings[1].socd == 1 && prof.mappings[1].socd_slot == 0);
+    CHECK(prof.mappings[2].socd == 1 && prof.mappings[2].socd_slot == 1);
+}
+
+/* ── Keymap offload ──────────────────────────────────────────────── */
+
+/*
+ * A fully offloaded device is left ungrabbed with its other scancodes
+ * reserved, so any profile that still needs events from it must not be.
+ */
+static void check_offload(void) {
+    static profile_t prof;
+    memset(&prof, 0, sizeof(prof));
+    CHECK(!keymap_full_offload(&prof));         /* nothing to offload */
+
+    prof.mappings[0].button = BTN_SIDE;
+    prof.mappings[0].kernel = 1;
+    prof.num_mappings = 1;
+    CHECK(keymap_full_offload(&prof));
+
+    prof.mappings[1].button = BTN_EXTRA;
+    prof.num_mappings = 2;
+    CHECK(!keymap_full_offload(&prof));         /* a combo stays with us */
+    prof.num_mappings = 1;
+
+    prof.keyboard = 1;
+    CHECK(!keymap_full_offload(&prof));
+    prof.keyboard = 0;
+
+    prof.pointer.sniper_button = BTN_EXTRA;
+    CHECK(!keymap_full_offload(&prof));
+    prof.pointer.sniper_button = 0;
+
+    prof.pointer.gesture.button = BTN_EXTRA;
+    CHECK(!keymap_full_offload(&prof));
+    prof.pointer.gesture.button = 0;
+
+    /* Passed through as-is, so not to be reserved with the unmapped ones */
+    prof.passthrough[BTN_MIDDLE / 8] |= 1 << (BTN_MIDDLE % 8);
+    CHECK(!keymap_full_offload(&prof));
+    memset(prof.passthrough, 0, sizeof(prof.passthrough));
+    CHECK(keymap_full_offload(&prof));
+}
+
+/* ── Main ──────────────────────────────────────────────────────────── */
+
+int main(void) {
+    check_hid();
+    check_hist();
+    check_accel();
+    check_expand();
+    check_classify();
+    check_stale_events();
+    check_mod_skipped();
+    check_socd();
+    check_offload();
+
+    fprintf(stderr, "%d checks, %d failed\n", g_checks, g_failed);
+    return g_failed != 0;
+}
@@ -0,0 +1,278 @@
+/*
+ * uhid-naga.c - Stand-in Naga keyboard interface for benchmarking
+ *
+ * Creates a /dev/uhid device with the Naga's vendor/product IDs, the
+ * side-button interface's phys and a boot keyboard descriptor, so both
+ * the evdev and the hidraw backend find it as they would the mouse. The
+ * daemon named after "--" is started with its output on a pipe; once it
+ * has opened the device, side-button presses and releases are replayed
+ * and each report is timed from its UHID_INPUT2 write to the daemon's
+ * write of the remapped events. Needs root, or access to /dev/uhid and
+ * the nodes it creates.
+ *
+ *   uhid-naga [-n reports] [-r hz] [-w settle_ms] -- naga-remap [args]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <linux/input.h>
+#include <linux/uhid.h>
+
+#include "../hist.h"
+
+#define RAZER_VENDOR    0x1532
+#define RAZER_PRODUCT   0x00B4
+#define NAGA_PHYS       "usb-uhid-naga/input2"
+#define REPLY_MS        1000    /* a report without output by then is lost */
+#define OPEN_SEC        10      /* for the daemon to open the device */
+
+/* Boot keyboard: 8 modifier bits, a reserved byte, 6 key slots */
+static const uint8_t naga_rdesc[] = {
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01,
+    0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25, 0x01,
+    0x75, 0x01, 0x95, 0x08, 0x81, 0x02,
+    0x95, 0x01, 0x75, 0x08, 0x81, 0x01,
+    0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x25, 0x65,
+    0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00,
+    0xC0,
+};
+
+/* HID usages of the side buttons, KEY_1 .. KEY_0, KEY_MINUS, KEY_EQUAL */
+static const uint8_t naga_buttons[] = {
+    0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x2D, 0x2E,
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t_ns) {
+    struct timespec ts = { (time_t)(t_ns / 1000000000ULL), (long)(t_ns % 1000000000ULL) };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+/* ── uhid ──────────────────────────────────────────────────────────── */
+
+static int uhid_write(int fd, const struct uhid_event *ev) {
+    if (write(fd, ev, sizeof(*ev)) != (ssize_t)sizeof(*ev)) {
+        perror("write uhid");
+        return -1;
+    }
+    return 0;
+}
+
+static int uhid_create(int fd) {
+    struct uhid_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_CREATE2;
+    snprintf((char *)ev.u.create2.name, sizeof(ev.u.create2.name),
+             "Razer Naga V2 HyperSpeed (uhid)");
+    snprintf((char *)ev.u.create2.phys, sizeof(ev.u.create2.phys), "%s", NAGA_PHYS);
+    memcpy(ev.u.create2.rd_data, naga_rdesc, sizeof(naga_rdesc));
+    ev.u.create2.rd_size = sizeof(naga_rdesc);
+    ev.u.create2.bus = BUS_USB;
+    ev.u.create2.vendor = RAZER_VENDOR;
+    ev.u.create2.product = RAZER_PRODUCT;
+    return uhid_write(fd, &ev);
+}
+
+static int uhid_report(int fd, uint8_t usage) {
+    struct uhid_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_INPUT2;
+    ev.u.input2.size = 8;
+    ev.u.input2.data[2] = usage;
+    return uhid_write(fd, &ev);
+}
+
+/*
+ * Handle what the kernel sent; returns 1 once the device has been opened.
+ * Report requests get a reply, or the caller would stall until they time
+ * out; LED output reports are ignored.
+ */
+static int uhid_poll(int fd) {
+    struct uhid_event ev, reply;
+    int opened = 0;
+    while (read(fd, &ev, sizeof(ev)) > 0) {
+        memset(&reply, 0, sizeof(reply));
+        switch (ev.type) {
+        case UHID_OPEN:
+            opened = 1;
+            break;
+        case UHID_GET_REPORT:
+            reply.type = UHID_GET_REPORT_REPLY;
+            reply.u.get_report_reply.id = ev.u.get_report.id;
+            reply.u.get_report_reply.err = EIO;
+            uhid_write(fd, &reply);
+            break;
+        case UHID_SET_REPORT:
+            reply.type = UHID_SET_REPORT_REPLY;
+            reply.u.set_report_reply.id = ev.u.set_report.id;
+            uhid_write(fd, &reply);
+            break;
+        default:
+            break;
+        }
+    }
+    return opened;
+}
+
+/* ── Daemon ────────────────────────────────────────────────────────── */
+
+/* Start argv with "--output /dev/fd/<out>" appended */
+static pid_t spawn(char **argv, int argc, int out) {
+    char **args = calloc((size_t)argc + 3, sizeof(*args));
+    char path[32];
+    if (!args)
+        return -1;
+    memcpy(args, argv, (size_t)argc * sizeof(*args));
+    snprintf(path, sizeof(path), "/dev/fd/%d", out);
+    args[argc] = "--output";
+    args[argc + 1] = path;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        execvp(args[0], args);
+        fprintf(stderr, "Cannot run %s: %s\n", args[0], strerror(errno));
+        _exit(127);
+    }
+    if (pid < 0)
+        perror("fork");
+    free(args);
+    return pid;
+}
+
+/* Drop whatever the daemon wrote so far */
+static void drain(int fd) {
+    char buf[4096];
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+}
+
+/* ── Main ──────────────────────────────────────────────────────────── */
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [options] -- <naga-remap> [args]\n"
+        "  -n <reports>   Reports to replay, presses and releases (default: 20000)\n"
+        "  -r <hz>        Reports per second (default: 1000)\n"
+        "  -w <ms>        Wait after the device is opened (default: 500)\n",
+        prog);
+}
+
+int main(int argc, char **argv) {
+    long reports = 20000, hz = 1000, settle_ms = 500;
+    int i;
+    for (i = 1; i < argc && strcmp(argv[i], "--") != 0; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            reports = atol(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            hz = atol(argv[++i]);
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            settle_ms = atol(argv[++i]);
+        else
+            break;
+    }
+    if (i + 1 >= argc || strcmp(argv[i], "--") != 0 || reports <= 0 || hz <= 0 || settle_ms < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    char **daemon_argv = &argv[i + 1];
+    int daemon_argc = argc - i - 1;
+
+    int uhid = open("/dev/uhid", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (uhid < 0) {
+        fprintf(stderr, "Cannot open /dev/uhid: %s\n", strerror(errno));
+        return 1;
+    }
+    if (uhid_create(uhid) < 0) {
+        close(uhid);
+        return 1;
+    }
+
+    int out[2];
+    if (pipe2(out, O_CLOEXEC) < 0) {
+        perror("pipe2");
+        close(uhid);
+        return 1;
+    }
+    /* The daemon's end stays open across exec */
+    fcntl(out[1], F_SETFD, 0);
+    fcntl(out[0], F_SETFL, O_NONBLOCK);
+    pid_t pid = spawn(daemon_argv, daemon_argc, out[1]);
+    close(out[1]);
+    if (pid < 0) {
+        close(uhid);
+        return 1;
+    }
+
+    /* Wait for the daemon to open the device, then for it to settle */
+    int rc = 1;
+    struct pollfd pfd = { .fd = uhid, .events = POLLIN };
+    uint64_t deadline = now_ns() + OPEN_SEC * 1000000000ULL;
+    int opened = 0, exited = 0;
+    while (!opened && !exited && now_ns() < deadline) {
+        exited = waitpid(pid, NULL, WNOHANG) != 0;
+        poll(&pfd, 1, 100);
+        opened = uhid_poll(uhid);
+    }
+    if (!opened) {
+        if (exited)
+            fprintf(stderr, "%s exited before opening the device\n", daemon_argv[0]);
+        else
+            fprintf(stderr, "Device not opened within %d s\n", OPEN_SEC);
+        goto out;
+    }
+    sleep_until(now_ns() + (uint64_t)settle_ms * 1000000ULL);
+    uhid_poll(uhid);
+    drain(out[0]);
+
+    /* Press and release each button in turn, one report per period */
+    static hist_t lat;
+    long lost = 0;
+    uint64_t period = 1000000000ULL / (uint64_t)hz, due = now_ns();
+    for (long r = 0; r < reports; r++) {
+        uint8_t usage = r & 1 ? 0 : naga_buttons[(r / 2) % sizeof(naga_buttons)];
+        drain(out[0]);
+        uint64_t t0 = now_ns();
+        if (uhid_report(uhid, usage) < 0)
+            goto out;
+        struct pollfd ofd = { .fd = out[0], .events = POLLIN };
+        if (poll(&ofd, 1, REPLY_MS) > 0 && (ofd.revents & POLLIN)) {
+            hist_add(&lat, now_ns() - t0);
+            drain(out[0]);
+        } else {
+            lost++;
+        }
+        uhid_poll(uhid);
+        due += period;
+        sleep_until(due);
+    }
+
+    fprintf(stderr, "uhid -> %s output: n=%lu p50=%.1f p90=%.1f p99=%.1f max=%.1f us, "
+            "%ld without output\n", daemon_argv[0], (unsigned long)lat.count,
+            hist_percentile(&lat, 0.50) / 1e3, hist_percentile(&lat, 0.90) / 1e3,
+            hist_percentile(&lat, 0.99) / 1e3, lat.max / 1e3, lost);
+    rc = lost != 0;
+
+out:
+    if (!exited) {
+        kill(pid, SIGINT);
+        waitpid(pid, NULL, 0);
+    }
+    close(out[0]);
+    close(uhid);                /* destroys the device */
+    return rc;
+}
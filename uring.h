@@ -0,0 +1,156 @@
+/*
+ * uring.h - Minimal io_uring wrapper for naga-remap
+ *
+ * Talks to the kernel through the raw io_uring_setup/io_uring_enter
+ * syscalls so the daemon keeps zero runtime dependencies (no liburing).
+ * Only what the remap hot path needs: one SQ/CQ pair, SQE allocation,
+ * batched submission and CQE iteration.
+ */
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* Multishot read landed in Linux 6.7; older uapi headers lack the opcode */
+#ifndef IORING_OP_READ_MULTISHOT
+#define IORING_OP_READ_MULTISHOT 49
+#endif
+
+typedef struct {
+    int fd;
+    unsigned features;              /* IORING_FEAT_* reported by setup */
+    /* submission ring */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_local_tail;         /* SQEs handed out, not yet published */
+    unsigned sq_submitted;          /* SQEs published to the kernel */
+    /* completion ring */
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    /* mappings, for teardown */
+    void *sq_ptr, *cq_ptr;
+    size_t sq_sz, cq_sz, sqes_sz;
+} uring_t;
+
+static int uring_init(uring_t *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        return -1;
+
+    r->features = p.features;
+    r->sq_sz   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_sz   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_sz > r->sq_sz) r->sq_sz = r->cq_sz;
+        r->cq_sz = r->sq_sz;
+    }
+
+    r->sq_ptr = mmap(NULL, r->sq_sz, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+        goto fail;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_sz, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED)
+            goto fail;
+    }
+
+    r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto fail;
+
+    char *sq = r->sq_ptr, *cq = r->cq_ptr;
+    r->sq_head  = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head  = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    r->sq_local_tail = r->sq_submitted = *r->sq_tail;
+    return 0;
+
+fail:
+    if (r->sq_ptr && r->sq_ptr != MAP_FAILED) munmap(r->sq_ptr, r->sq_sz);
+    if (r->cq_ptr && r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_sz);
+    close(r->fd);
+    r->fd = -1;
+    return -1;
+}
+
+static void uring_exit(uring_t *r) {
+    if (r->fd < 0)
+        return;
+    munmap(r->sqes, r->sqes_sz);
+    if (r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_sz);
+    munmap(r->sq_ptr, r->sq_sz);
+    close(r->fd);
+    r->fd = -1;
+}
+
+/* Next free SQE, zeroed; NULL when the ring is full */
+static struct io_uring_sqe *uring_get_sqe(uring_t *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sq_local_tail - head > *r->sq_mask)
+        return NULL;
+    unsigned idx = r->sq_local_tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    r->sq_local_tail++;
+    return sqe;
+}
+
+/* SQEs that can still be handed out before the ring is full */
+static unsigned uring_sq_space(const uring_t *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    return *r->sq_mask + 1 - (r->sq_local_tail - head);
+}
+
+static unsigned uring_pending(const uring_t *r) {
+    return r->sq_local_tail - r->sq_submitted;
+}
+
+/* Publish queued SQEs and enter the kernel; optionally wait for CQEs */
+static int uring_submit(uring_t *r, unsigned wait_nr) {
+    unsigned n = uring_pending(r);
+    __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+    r->sq_submitted = r->sq_local_tail;
+    if (n == 0 && wait_nr == 0)
+        return 0;
+    return (int)syscall(__NR_io_uring_enter, r->fd, n, wait_nr,
+                        wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+/* Oldest unconsumed CQE, or NULL if the completion ring is empty */
+static struct io_uring_cqe *uring_peek_cqe(uring_t *r) {
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &r->cqes[head & *r->cq_mask];
+}
+
+static void uring_cqe_seen(uring_t *r) {
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* URING_H */